@@ -0,0 +1,39 @@
+#include "alloc_counter.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+    std::atomic<std::size_t> allocations_count{0};
+}
+
+std::size_t alloc_counter::allocations() noexcept {
+    return allocations_count.load(std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size) {
+    allocations_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    allocations_count.fetch_add(1, std::memory_order_relaxed);
+    std::size_t align = static_cast<std::size_t>(alignment);
+    if (void* ptr = std::aligned_alloc(align, (size + align - 1) / align * align))
+        return ptr;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstddef>
+
+namespace alloc_counter {
+    std::size_t allocations() noexcept;
+}
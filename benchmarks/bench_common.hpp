@@ -0,0 +1,95 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+namespace bench {
+
+    enum distribution_t : int { sequential, uniform, zipf, adversarial, distributions_count };
+
+    inline const char* distribution_name(int distribution) {
+        static const char* names[] = {"sequential", "random", "zipf", "adversarial"};
+        return names[distribution];
+    }
+
+    inline std::vector<int> random_keys(std::size_t count, unsigned seed = 42) {
+        std::mt19937 gen{seed};
+        std::uniform_int_distribution<int> dist;
+        std::vector<int> keys(count);
+        for (auto& key : keys)
+            key = dist(gen);
+        return keys;
+    }
+
+    // sequential: 0, 1, 2, ..., rotation at every other insert
+    // zipf:       ranks with P(r) ~ 1 / r over count ranks, scattered over ints
+    // adversarial: 0, n-1, 1, n-2, ..., every insert goes to an outermost leaf
+    inline std::vector<int> make_keys(int distribution, std::size_t count, unsigned seed = 42) {
+        std::vector<int> keys(count);
+        switch (distribution) {
+            case sequential:
+                for (std::size_t i = 0; i < count; ++i)
+                    keys[i] = static_cast<int>(i);
+                break;
+
+            case uniform:
+                return random_keys(count, seed);
+
+            case zipf: {
+                // inverse cdf of the continuous 1 / r density on [1, count + 1)
+                std::mt19937 gen{seed};
+                std::uniform_real_distribution<double> dist;
+                double log_count = std::log(static_cast<double>(count) + 1);
+                for (auto& key : keys) {
+                    auto rank = static_cast<std::uint32_t>(std::exp(dist(gen) * log_count));
+                    key = static_cast<int>(rank * 2654435761u);
+                }
+                break;
+            }
+
+            case adversarial:
+                for (std::size_t i = 0; i < count; ++i)
+                    keys[i] = static_cast<int>((i % 2) ? count - 1 - i / 2 : i / 2);
+                break;
+        }
+        return keys;
+    }
+
+    // largest tree size, 10^6 by default, up to 10^8 through PERM_TREE_BENCH_MAX_KEYS
+    inline std::int64_t max_keys() {
+        const char* value = std::getenv("PERM_TREE_BENCH_MAX_KEYS");
+        return value ? std::stoll(value) : 1000000;
+    }
+
+    // arguments: {distribution, keys count} for 10^3 ... max_keys()
+    inline void distribution_sizes(benchmark::internal::Benchmark* b) {
+        b->ArgNames({"dist", "keys"});
+        for (int distribution = 0; distribution < distributions_count; ++distribution)
+            for (std::int64_t count = 1000; count <= max_keys(); count *= 10)
+                b->Args({distribution, count});
+    }
+
+    inline void set_allocs_counter(benchmark::State& state, std::size_t allocs, std::size_t ops) {
+        state.counters["allocs/op"] = static_cast<double>(allocs) / static_cast<double>(ops);
+    }
+
+    // time/op in seconds (shown with a unit prefix), the peak RSS of the whole
+    // process so far, so run one benchmark per process when gating it
+    inline void set_common_counters(benchmark::State& state, std::size_t ops, std::size_t allocs) {
+        state.SetLabel(distribution_name(state.range(0)));
+        state.counters["time/op"] = benchmark::Counter(static_cast<double>(ops),
+                                                       benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+        set_allocs_counter(state, allocs, ops);
+
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        state.counters["peak_rss_MB"] = static_cast<double>(usage.ru_maxrss) / 1024;
+    }
+}
@@ -0,0 +1,131 @@
+#include "perm_tree.hpp"
+#include "tree_file.hpp"
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <numeric>
+#include <random>
+
+namespace {
+    std::vector<int> sorted_keys(std::size_t count) {
+        std::vector<int> keys(count);
+        std::iota(keys.begin(), keys.end(), 0);
+        return keys;
+    }
+
+    std::vector<int> shuffled_keys(std::size_t count) {
+        std::vector<int> keys = sorted_keys(count);
+        std::shuffle(keys.begin(), keys.end(), std::mt19937{11});
+        return keys;
+    }
+}
+
+static void BM_build_insert_loop(benchmark::State& state) {
+    std::vector<int> keys = shuffled_keys(state.range(0));
+    for (auto _ : state) {
+        perm_tree::perm_tree_t<int> tree;
+        for (int key : keys)
+            tree.insert(key);
+        benchmark::DoNotOptimize(tree.get_root());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_build_insert_loop)->RangeMultiplier(10)->Range(100000, 10000000)
+                               ->Unit(benchmark::kMillisecond);
+
+static void BM_build_from_sorted(benchmark::State& state) {
+    std::vector<int> keys = sorted_keys(state.range(0));
+    for (auto _ : state) {
+        perm_tree::perm_tree_t<int> tree;
+        tree.build_from_sorted(keys.begin(), keys.end());
+        benchmark::DoNotOptimize(tree.get_root());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_build_from_sorted)->RangeMultiplier(10)->Range(100000, 10000000)
+                               ->Unit(benchmark::kMillisecond);
+
+static void BM_build_from_unsorted(benchmark::State& state) {
+    std::vector<int> keys = shuffled_keys(state.range(0));
+    for (auto _ : state) {
+        perm_tree::perm_tree_t<int> tree{keys.begin(), keys.end()};
+        benchmark::DoNotOptimize(tree.get_root());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+BENCHMARK(BM_build_from_unsorted)->RangeMultiplier(10)->Range(100000, 10000000)
+                                 ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// merges a delta of range(0) / 10 keys into a tree of range(0) keys
+static void BM_merge_insert_loop(benchmark::State& state) {
+    std::vector<int> keys  = shuffled_keys(state.range(0));
+    std::vector<int> delta = shuffled_keys(state.range(0) / 10);
+    for (int& key : delta)
+        key = key * 10 + 5;
+
+    perm_tree::perm_tree_t<int> main{keys.begin(), keys.end()};
+    for (auto _ : state) {
+        state.PauseTiming();
+        perm_tree::perm_tree_t<int> tree{main};
+        state.ResumeTiming();
+
+        for (int key : delta)
+            tree.insert(key);
+        benchmark::DoNotOptimize(tree.get_root());
+    }
+    state.SetItemsProcessed(state.iterations() * delta.size());
+}
+BENCHMARK(BM_merge_insert_loop)->RangeMultiplier(10)->Range(100000, 10000000)
+                               ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_merge_unite(benchmark::State& state) {
+    std::vector<int> keys  = shuffled_keys(state.range(0));
+    std::vector<int> delta = shuffled_keys(state.range(0) / 10);
+    for (int& key : delta)
+        key = key * 10 + 5;
+
+    perm_tree::perm_tree_t<int> main{keys.begin(), keys.end()};
+    avl_tree::avl_tree_t<int> delta_tree{delta.begin(), delta.end()};
+    for (auto _ : state) {
+        state.PauseTiming();
+        perm_tree::perm_tree_t<int> tree{main};
+        state.ResumeTiming();
+
+        tree.unite(delta_tree);
+        benchmark::DoNotOptimize(tree.get_root());
+    }
+    state.SetItemsProcessed(state.iterations() * delta.size());
+}
+BENCHMARK(BM_merge_unite)->RangeMultiplier(10)->Range(100000, 10000000)
+                         ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// restart from a file of tree_file::save: mapping alone, which checks every
+// node once, and mapping followed by a perm_tree_t built from the mapped nodes
+static void BM_restore_map(benchmark::State& state) {
+    std::vector<int> keys = shuffled_keys(state.range(0));
+    auto file_name = (std::filesystem::temp_directory_path() / "perm_tree_bench.tree").string();
+    tree_file::save(file_name, perm_tree::perm_tree_t<int>{keys.begin(), keys.end()}.frozen());
+
+    for (auto _ : state) {
+        tree_file::mapped_tree_t<perm_tree::perm_tree_t<int>> mapped{file_name};
+        benchmark::DoNotOptimize(mapped.tree().contains(keys[0]));
+    }
+    std::filesystem::remove(file_name);
+}
+BENCHMARK(BM_restore_map)->RangeMultiplier(10)->Range(100000, 10000000)
+                         ->Unit(benchmark::kMicrosecond);
+
+static void BM_restore_thaw(benchmark::State& state) {
+    std::vector<int> keys = shuffled_keys(state.range(0));
+    auto file_name = (std::filesystem::temp_directory_path() / "perm_tree_bench.tree").string();
+    tree_file::save(file_name, perm_tree::perm_tree_t<int>{keys.begin(), keys.end()}.frozen());
+
+    for (auto _ : state) {
+        tree_file::mapped_tree_t<perm_tree::perm_tree_t<int>> mapped{file_name, MADV_SEQUENTIAL};
+        perm_tree::perm_tree_t<int> tree{mapped.tree()};
+        benchmark::DoNotOptimize(tree.get_root());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    std::filesystem::remove(file_name);
+}
+BENCHMARK(BM_restore_thaw)->RangeMultiplier(10)->Range(100000, 10000000)
+                          ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,41 @@
+import sys
+import json
+import argparse
+
+# compares two json outputs of bench_perm_tree and fails when a benchmark
+# present in both became slower or allocates more than the threshold allows
+
+def load(file_name):
+    with open(file_name) as file:
+        results = json.load(file)["benchmarks"]
+    return {bench["name"] : bench for bench in results if bench.get("run_type") != "aggregate"}
+
+parser = argparse.ArgumentParser()
+parser.add_argument("baseline")
+parser.add_argument("current")
+parser.add_argument("--threshold", type=float, default=0.10, help="allowed relative slowdown")
+args = parser.parse_args()
+
+baseline = load(args.baseline)
+current  = load(args.current)
+
+failed = 0
+for name, bench in current.items():
+    if name not in baseline:
+        continue
+
+    old_time = baseline[name]["real_time"]
+    new_time = bench["real_time"]
+    change   = (new_time - old_time) / old_time
+    if change > args.threshold:
+        print(f"{name}: time {old_time:.4g} -> {new_time:.4g} ({change:+.1%})")
+        failed += 1
+
+    old_allocs = baseline[name].get("allocs/op", 0)
+    new_allocs = bench.get("allocs/op", 0)
+    if new_allocs > old_allocs * (1 + args.threshold) + 1e-9:
+        print(f"{name}: allocs/op {old_allocs:.4g} -> {new_allocs:.4g}")
+        failed += 1
+
+print(f"{failed} regressions in {len(current)} benchmarks")
+sys.exit(1 if failed else 0)
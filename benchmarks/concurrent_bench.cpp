@@ -0,0 +1,74 @@
+#include "bench_common.hpp"
+#include "concurrent_tree.hpp"
+#include <atomic>
+#include <thread>
+
+// lookups of reader threads over concurrent_tree_t snapshots, with and without
+// a writer inserting meanwhile; items/s of all threads shows the scaling
+
+namespace {
+    using tree_t = concurrent_tree::concurrent_tree_t<int>;
+
+    constexpr std::size_t tree_size = 1000000;
+
+    tree_t& shared_tree() {
+        static tree_t tree;
+        static bool built = [] {
+            for (int key : bench::random_keys(tree_size))
+                tree.insert(key);
+            return true;
+        }();
+        (void)built;
+        return tree;
+    }
+
+    // one snapshot per batch of lookups, as a query thread would take it
+    void read(benchmark::State& state, tree_t& tree) {
+        std::vector<int> queries = bench::random_keys(1 << 16, 43 + state.thread_index());
+        tree_t::reader_t reader{tree};
+
+        constexpr std::size_t batch = 64;
+        std::size_t found = 0;
+        std::size_t i = 0;
+        for (auto _ : state) {
+            tree_t::snapshot_t snapshot{reader};
+            auto view = snapshot.view();
+            for (std::size_t j = 0; j < batch; ++j)
+                found += view.contains(queries[i++ % queries.size()]);
+        }
+        benchmark::DoNotOptimize(found);
+        state.SetItemsProcessed(state.iterations() * batch);
+    }
+
+    // the writer runs between setup and teardown, which google benchmark
+    // calls on one thread outside the timed region
+    std::atomic<bool> writer_done;
+    std::jthread writer;
+}
+
+static void BM_concurrent_read(benchmark::State& state) {
+    read(state, shared_tree());
+}
+BENCHMARK(BM_concurrent_read)->ThreadRange(1, std::max(1u, std::thread::hardware_concurrency()))->UseRealTime();
+
+static void BM_concurrent_read_while_writing(benchmark::State& state) {
+    read(state, shared_tree());
+}
+BENCHMARK(BM_concurrent_read_while_writing)
+    ->Setup([](const benchmark::State&) {
+        tree_t& tree = shared_tree();
+        writer_done = false;
+        writer = std::jthread{[&tree] {
+            for (int key : bench::random_keys(1 << 20, 44)) {
+                if (writer_done.load(std::memory_order_relaxed))
+                    break;
+                tree.insert(key);
+            }
+        }};
+    })
+    ->Teardown([](const benchmark::State&) {
+        writer_done = true;
+        writer = std::jthread{};
+        shared_tree().reclaim();
+    })
+    ->ThreadRange(1, std::max(1u, std::thread::hardware_concurrency()))->UseRealTime();
@@ -0,0 +1,193 @@
+#include "alloc_counter.hpp"
+#include "bench_common.hpp"
+#include "perm_tree.hpp"
+
+// every benchmark takes {distribution, keys count}: the tree is built from
+// keys of that distribution and operations use keys of the same one
+
+namespace {
+    using tree_t = perm_tree::perm_tree_t<int>;
+
+    tree_t make_tree(const std::vector<int>& keys) {
+        tree_t tree;
+        for (int key : keys)
+            tree.insert(key);
+        return tree;
+    }
+
+    // same heuristic as the driver, out of the timed region
+    void release_versions(benchmark::State& state, tree_t& tree) {
+        if (tree.stored_nodes() <= 4 * tree.size() + 4096)
+            return;
+
+        state.PauseTiming();
+        tree.release_versions();
+        state.ResumeTiming();
+    }
+}
+
+static void BM_hot_insert(benchmark::State& state) {
+    std::vector<int> keys = bench::make_keys(state.range(0), state.range(1));
+    std::size_t allocs = 0;
+    for (auto _ : state) {
+        std::size_t start = alloc_counter::allocations();
+        tree_t tree = make_tree(keys);
+        allocs += alloc_counter::allocations() - start;
+        benchmark::DoNotOptimize(tree.get_root());
+    }
+    bench::set_common_counters(state, state.iterations() * keys.size(), allocs);
+}
+BENCHMARK(BM_hot_insert)->Apply(bench::distribution_sizes)->Unit(benchmark::kMillisecond);
+
+static void BM_hot_detach_insert_reset(benchmark::State& state) {
+    tree_t tree = make_tree(bench::make_keys(state.range(0), state.range(1)));
+    std::vector<int> queries = bench::make_keys(state.range(0), 1024, 43);
+
+    tree_t::insert_path_t path;
+    std::size_t allocs = 0;
+    std::size_t i = 0;
+    for (auto _ : state) {
+        std::size_t start = alloc_counter::allocations();
+        path.clear();
+        tree.detach_insert(queries[i++ % queries.size()], std::back_inserter(path));
+        tree.reset();
+        allocs += alloc_counter::allocations() - start;
+        benchmark::DoNotOptimize(path.size());
+        release_versions(state, tree);
+    }
+    bench::set_common_counters(state, state.iterations(), allocs);
+}
+BENCHMARK(BM_hot_detach_insert_reset)->Apply(bench::distribution_sizes);
+
+static void BM_hot_detach_insert_attach(benchmark::State& state) {
+    tree_t tree = make_tree(bench::make_keys(state.range(0), state.range(1)));
+    std::vector<int> queries = bench::make_keys(state.range(0), 1024, 43);
+
+    tree_t::insert_path_t path;
+    std::size_t allocs = 0;
+    std::size_t i = 0;
+    for (auto _ : state) {
+        std::size_t start = alloc_counter::allocations();
+        path.clear();
+        tree.detach_insert(queries[i++ % queries.size()], std::back_inserter(path));
+        tree.attach();
+        allocs += alloc_counter::allocations() - start;
+        benchmark::DoNotOptimize(path.size());
+        release_versions(state, tree);
+    }
+    bench::set_common_counters(state, state.iterations(), allocs);
+}
+BENCHMARK(BM_hot_detach_insert_attach)->Apply(bench::distribution_sizes);
+
+static void BM_hot_copy(benchmark::State& state) {
+    tree_t tree = make_tree(bench::make_keys(state.range(0), state.range(1)));
+    std::size_t allocs = 0;
+    for (auto _ : state) {
+        std::size_t start = alloc_counter::allocations();
+        tree_t copy{tree};
+        allocs += alloc_counter::allocations() - start;
+        benchmark::DoNotOptimize(copy.get_root());
+    }
+    bench::set_common_counters(state, state.iterations() * tree.size(), allocs);
+}
+BENCHMARK(BM_hot_copy)->Apply(bench::distribution_sizes);
+
+static void BM_hot_lower_bound(benchmark::State& state) {
+    tree_t tree = make_tree(bench::make_keys(state.range(0), state.range(1)));
+    std::vector<int> queries = bench::make_keys(state.range(0), 1 << 16, 43);
+    auto view = tree.view();
+
+    std::size_t allocs = 0;
+    std::size_t i = 0;
+    for (auto _ : state) {
+        std::size_t start = alloc_counter::allocations();
+        benchmark::DoNotOptimize(view.lower_bound(queries[i++ % queries.size()]));
+        allocs += alloc_counter::allocations() - start;
+    }
+    bench::set_common_counters(state, state.iterations(), allocs);
+}
+BENCHMARK(BM_hot_lower_bound)->Apply(bench::distribution_sizes);
+
+static void BM_hot_insert_path(benchmark::State& state) {
+    tree_t tree = make_tree(bench::make_keys(state.range(0), state.range(1)));
+    std::vector<int> queries = bench::make_keys(state.range(0), 1 << 16, 43);
+    auto view = tree.view();
+
+    tree_t::insert_path_t path;
+    std::size_t allocs = 0;
+    std::size_t i = 0;
+    for (auto _ : state) {
+        std::size_t start = alloc_counter::allocations();
+        path.clear();
+        view.insert_path(queries[i++ % queries.size()], std::back_inserter(path));
+        allocs += alloc_counter::allocations() - start;
+        benchmark::DoNotOptimize(path.size());
+    }
+    bench::set_common_counters(state, state.iterations(), allocs);
+}
+BENCHMARK(BM_hot_insert_path)->Apply(bench::distribution_sizes);
+
+// same queries on the van Emde Boas copy of the same tree
+static void BM_hot_frozen_insert_path(benchmark::State& state) {
+    tree_t tree = make_tree(bench::make_keys(state.range(0), state.range(1)));
+    std::vector<int> queries = bench::make_keys(state.range(0), 1 << 16, 43);
+    auto frozen = tree.frozen();
+
+    tree_t::insert_path_t path;
+    std::size_t allocs = 0;
+    std::size_t i = 0;
+    for (auto _ : state) {
+        std::size_t start = alloc_counter::allocations();
+        path.clear();
+        frozen.insert_path(queries[i++ % queries.size()], std::back_inserter(path));
+        allocs += alloc_counter::allocations() - start;
+        benchmark::DoNotOptimize(path.size());
+    }
+    bench::set_common_counters(state, state.iterations(), allocs);
+}
+BENCHMARK(BM_hot_frozen_insert_path)->Apply(bench::distribution_sizes);
+
+// paths of a batch of queries at once, arg 2 is batch_search::isa_t
+static void BM_hot_frozen_insert_paths(benchmark::State& state) {
+    tree_t tree = make_tree(bench::make_keys(state.range(0), state.range(1)));
+    std::vector<int> queries = bench::make_keys(state.range(0), 1 << 16, 43);
+    auto frozen = tree.frozen();
+    auto isa = static_cast<batch_search::isa_t>(state.range(2));
+    if (!batch_search::supported(isa)) {
+        state.SkipWithError("no avx2");
+        return;
+    }
+
+    std::size_t allocs = 0;
+    for (auto _ : state) {
+        std::size_t start = alloc_counter::allocations();
+        auto paths = frozen.insert_paths(queries.begin(), queries.end(), isa);
+        allocs += alloc_counter::allocations() - start;
+        benchmark::DoNotOptimize(paths.keys().data());
+    }
+    bench::set_common_counters(state, state.iterations() * queries.size(), allocs);
+}
+BENCHMARK(BM_hot_frozen_insert_paths)->Apply([](benchmark::internal::Benchmark* b) {
+    b->ArgNames({"dist", "keys", "isa"});
+    for (int distribution = 0; distribution < bench::distributions_count; ++distribution)
+        for (std::int64_t count = 1000; count <= bench::max_keys(); count *= 10)
+            for (int isa = 0; isa < 2; ++isa)
+                b->Args({distribution, count, isa});
+})->Unit(benchmark::kMillisecond);
+
+static void BM_hot_kth(benchmark::State& state) {
+    tree_t tree = make_tree(bench::make_keys(state.range(0), state.range(1)));
+    std::vector<int> queries = bench::random_keys(1 << 16, 43);
+    auto view = tree.view();
+
+    std::size_t allocs = 0;
+    std::size_t i = 0;
+    for (auto _ : state) {
+        std::size_t start = alloc_counter::allocations();
+        std::size_t k = static_cast<unsigned>(queries[i++ % queries.size()]) % view.size();
+        benchmark::DoNotOptimize(view.kth(k));
+        allocs += alloc_counter::allocations() - start;
+    }
+    bench::set_common_counters(state, state.iterations(), allocs);
+}
+BENCHMARK(BM_hot_kth)->Apply(bench::distribution_sizes);
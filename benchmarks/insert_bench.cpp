@@ -0,0 +1,74 @@
+#include "alloc_counter.hpp"
+#include "bench_common.hpp"
+#include "perm_tree.hpp"
+
+using bench::random_keys;
+using bench::set_allocs_counter;
+
+static void BM_avl_insert_random(benchmark::State& state) {
+    std::vector<int> keys = random_keys(state.range(0));
+    std::size_t allocs = 0;
+    for (auto _ : state) {
+        avl_tree::avl_tree_t<int> tree;
+        std::size_t start = alloc_counter::allocations();
+        for (int key : keys)
+            tree.insert(key);
+        allocs += alloc_counter::allocations() - start;
+        benchmark::DoNotOptimize(tree.get_root());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    set_allocs_counter(state, allocs, state.iterations() * keys.size());
+}
+BENCHMARK(BM_avl_insert_random)->RangeMultiplier(10)->Range(1000, 1000000);
+
+static void BM_perm_detach_insert(benchmark::State& state) {
+    std::vector<int> keys = random_keys(state.range(0));
+    perm_tree::perm_tree_t<int> tree;
+    for (int key : keys)
+        tree.insert(key);
+
+    std::vector<int> queries = random_keys(1024, 43);
+    std::size_t allocs = 0;
+    std::size_t i = 0;
+    for (auto _ : state) {
+        int key = queries[i++ % queries.size()];
+        std::size_t start = alloc_counter::allocations();
+        benchmark::DoNotOptimize(tree.detach_insert(key));
+        tree.reset();
+        allocs += alloc_counter::allocations() - start;
+
+        // every detach_insert keeps a version, drop them so the run length does not matter
+        if (tree.stored_nodes() > 2 * tree.size()) {
+            state.PauseTiming();
+            tree.release_versions();
+            state.ResumeTiming();
+        }
+    }
+    set_allocs_counter(state, allocs, state.iterations());
+}
+BENCHMARK(BM_perm_detach_insert)->RangeMultiplier(10)->Range(1000, 1000000);
+
+static void BM_perm_detach_insert_batch(benchmark::State& state) {
+    std::vector<int> keys = random_keys(1000000);
+    perm_tree::perm_tree_t<int> tree{keys.begin(), keys.end()};
+
+    std::vector<int> batch = random_keys(state.range(0), 43);
+    std::size_t copies = 0;
+    for (auto _ : state) {
+        std::size_t stored = tree.stored_nodes();
+        benchmark::DoNotOptimize(tree.detach_insert(batch.begin(), batch.end()));
+        copies += tree.stored_nodes() - stored;
+
+        tree.reset();
+        if (tree.stored_nodes() > 2 * tree.size()) {
+            state.PauseTiming();
+            tree.release_versions();
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * batch.size());
+    state.counters["nodes/key"] = static_cast<double>(copies) / (state.iterations() * batch.size());
+}
+BENCHMARK(BM_perm_detach_insert_batch)->RangeMultiplier(10)->Range(10, 10000);
+
+BENCHMARK_MAIN();
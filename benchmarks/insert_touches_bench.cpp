@@ -0,0 +1,62 @@
+#include "avl_tree.hpp"
+#include "bench_common.hpp"
+#include "tree_stats.hpp"
+#include <memory>
+#include <random>
+
+namespace {
+    using avl_tree::event_t;
+    using counted_tree_t = avl_tree::avl_tree_t<int, std::less<int>, avl_tree::tree_stats_t>;
+
+    // building a tree of max_keys() keys takes a while, so keep the last one between runs
+    counted_tree_t& prebuilt_tree(std::size_t size) {
+        static std::unique_ptr<counted_tree_t> tree;
+        static std::size_t tree_size = 0;
+        if (tree && tree_size == size)
+            return *tree;
+
+        tree.reset();
+        tree = std::make_unique<counted_tree_t>();
+        tree_size = size;
+
+        std::mt19937 gen{7};
+        std::uniform_int_distribution<int> dist;
+        while (tree->size() < size)
+            tree->insert(dist(gen));
+        return *tree;
+    }
+}
+
+// nodes an insertion touches on its way up: every ancestor gets its size, but
+// heights are recomputed only up to the first one whose height stays the same
+static void BM_avl_insert_touches(benchmark::State& state) {
+    counted_tree_t& tree = prebuilt_tree(state.range(0));
+
+    std::mt19937 gen{13};
+    std::uniform_int_distribution<int> dist;
+    tree.stats().clear();
+    for (auto _ : state) {
+        int key = dist(gen);
+        std::size_t size = tree.size();
+        benchmark::DoNotOptimize(tree.insert(key));
+
+        // the tree keeps its size, and the erase is not counted
+        if (tree.size() != size) {
+            state.PauseTiming();
+            avl_tree::tree_stats_t stats = tree.stats();
+            tree.erase(key);
+            tree.stats() = stats;
+            state.ResumeTiming();
+        }
+    }
+
+    const avl_tree::tree_stats_t& stats = tree.stats();
+    auto per_op = [&](std::uint64_t count) { return static_cast<double>(count) / state.iterations(); };
+    state.counters["compares/op"]         = per_op(stats[event_t::compare]);
+    state.counters["ancestor_updates/op"] = per_op(stats[event_t::ancestor_update]);
+    state.counters["height_updates/op"]   = per_op(stats[event_t::height_update]);
+    state.counters["rotations/op"]        = per_op(stats[event_t::rotate_left] + stats[event_t::rotate_right]);
+    state.counters["node_copies/op"]      = per_op(stats[event_t::node_copy]);
+    state.counters["height"]              = tree.get_root()->height_;
+}
+BENCHMARK(BM_avl_insert_touches)->RangeMultiplier(10)->Range(1000, bench::max_keys());
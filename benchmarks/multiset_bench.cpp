@@ -0,0 +1,79 @@
+#include "alloc_counter.hpp"
+#include "avl_multiset.hpp"
+#include "bench_common.hpp"
+#include "perm_tree.hpp"
+#include <set>
+
+// nodes shared by the main and the detached trees: compacting them with
+// release_versions and laying them out with frozen() (each shared node is kept
+// once, found by descending the main tree by its key); and multisets of zipf
+// keys, where most inserts are duplicates, against std::multiset
+
+using bench::set_allocs_counter;
+
+namespace {
+    // main tree of count random keys, detached tree with count / 100 more
+    perm_tree::perm_tree_t<int> detached_tree(std::size_t count) {
+        std::vector<int> keys = bench::random_keys(count + count / 100);
+        perm_tree::perm_tree_t<int> tree{keys.begin(), keys.begin() + count};
+        tree.detach_insert(keys.begin() + count, keys.end());
+        return tree;
+    }
+}
+
+static void BM_shared_release_versions(benchmark::State& state) {
+    perm_tree::perm_tree_t<int> tree = detached_tree(state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        perm_tree::perm_tree_t<int> copy{tree};
+        state.ResumeTiming();
+
+        copy.release_versions();
+        benchmark::DoNotOptimize(copy.get_root());
+    }
+    state.SetItemsProcessed(state.iterations() * tree.stored_nodes());
+}
+BENCHMARK(BM_shared_release_versions)->RangeMultiplier(10)->Range(1000, 1000000);
+
+static void BM_shared_frozen(benchmark::State& state) {
+    perm_tree::perm_tree_t<int> tree = detached_tree(state.range(0));
+    for (auto _ : state) {
+        auto frozen = tree.frozen();
+        benchmark::DoNotOptimize(frozen.bytes().data());
+    }
+    state.SetItemsProcessed(state.iterations() * tree.stored_nodes());
+}
+BENCHMARK(BM_shared_frozen)->RangeMultiplier(10)->Range(1000, 1000000);
+
+template <typename SetT>
+static void BM_multiset_insert(benchmark::State& state) {
+    std::vector<int> keys = bench::make_keys(bench::zipf, state.range(0));
+    std::size_t allocs = 0;
+    for (auto _ : state) {
+        SetT set;
+        std::size_t start = alloc_counter::allocations();
+        for (int key : keys)
+            set.insert(key);
+        allocs += alloc_counter::allocations() - start;
+        benchmark::DoNotOptimize(set.size());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    set_allocs_counter(state, allocs, state.iterations() * keys.size());
+}
+BENCHMARK(BM_multiset_insert<avl_multiset::avl_multiset_t<int>>)->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK(BM_multiset_insert<std::multiset<int>>)->RangeMultiplier(10)->Range(1000, 1000000);
+
+template <typename SetT>
+static void BM_multiset_count(benchmark::State& state) {
+    std::vector<int> keys = bench::make_keys(bench::zipf, state.range(0));
+    SetT set{keys.begin(), keys.end()};
+
+    std::size_t found = 0;
+    std::size_t i = 0;
+    for (auto _ : state)
+        found += set.count(keys[i++ % keys.size()]);
+    benchmark::DoNotOptimize(found);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_multiset_count<avl_multiset::avl_multiset_t<int>>)->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK(BM_multiset_count<std::multiset<int>>)->RangeMultiplier(10)->Range(1000, 1000000);
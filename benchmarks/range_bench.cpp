@@ -0,0 +1,55 @@
+#include "bench_common.hpp"
+#include "perm_tree.hpp"
+#include <algorithm>
+#include <set>
+
+// range reports over 10^6 random keys, ranges of 10 ... 10^5 keys starting at
+// random keys: for_each_in_range, iterators from lower_bound, and kth(rank + i)
+// for each key, which is how a range was read before there were iterators
+
+namespace {
+    enum scan_t : int { for_each, iterators, kth, std_set };
+
+    constexpr std::size_t tree_keys = 1000000;
+}
+
+template <int Scan>
+static void BM_range_scan(benchmark::State& state) {
+    std::vector<int> keys = bench::random_keys(tree_keys);
+    avl_tree::avl_tree_t<int> tree{keys.begin(), keys.end()};
+    std::set<int> set{keys.begin(), keys.end()};
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    std::size_t width = state.range(0);
+    std::vector<int> firsts = bench::random_keys(1024, 43);
+    for (int& first : firsts)
+        first = keys[static_cast<unsigned>(first) % (keys.size() - width)];
+
+    std::size_t i = 0;
+    std::size_t scanned = 0;
+    long long sum = 0;
+    for (auto _ : state) {
+        int first = firsts[i++ % firsts.size()];
+        int last  = *(std::lower_bound(keys.begin(), keys.end(), first) + width - 1);
+        if constexpr (Scan == for_each) {
+            tree.for_each_in_range(first, last, [&](int key) { sum += key; });
+        } else if constexpr (Scan == iterators) {
+            for (auto it = tree.lower_bound(first); it != tree.end() && *it <= last; ++it)
+                sum += *it;
+        } else if constexpr (Scan == kth) {
+            for (std::size_t k = tree.rank(first), end = k + width; k < end; ++k)
+                sum += *tree.kth(k);
+        } else {
+            for (auto it = set.lower_bound(first); it != set.end() && *it <= last; ++it)
+                sum += *it;
+        }
+        scanned += width;
+    }
+    benchmark::DoNotOptimize(sum);
+    state.SetItemsProcessed(scanned);
+}
+BENCHMARK(BM_range_scan<for_each>)->RangeMultiplier(100)->Range(10, 100000);
+BENCHMARK(BM_range_scan<iterators>)->RangeMultiplier(100)->Range(10, 100000);
+BENCHMARK(BM_range_scan<kth>)->RangeMultiplier(100)->Range(10, 100000);
+BENCHMARK(BM_range_scan<std_set>)->RangeMultiplier(100)->Range(10, 100000);
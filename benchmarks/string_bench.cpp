@@ -0,0 +1,90 @@
+#include "alloc_counter.hpp"
+#include "bench_common.hpp"
+#include "perm_tree.hpp"
+#include <string>
+#include <string_view>
+
+// std::string keys of 32 chars, too long for the small string buffer, so every
+// copy allocates: inserts copying or moving the keys, and lookups by a
+// std::string_view with std::less<std::string> (a key is built per lookup)
+// and with the transparent std::less<>
+
+using bench::set_allocs_counter;
+
+namespace {
+    std::vector<std::string> string_keys(std::size_t count, unsigned seed = 42) {
+        std::vector<std::string> keys;
+        keys.reserve(count);
+        for (int key : bench::random_keys(count, seed)) {
+            std::string value(32, 'k');
+            std::string number = std::to_string(static_cast<unsigned>(key));
+            value.replace(value.size() - number.size(), number.size(), number);
+            keys.push_back(std::move(value));
+        }
+        return keys;
+    }
+}
+
+static void BM_string_insert_copy(benchmark::State& state) {
+    std::vector<std::string> keys = string_keys(state.range(0));
+    std::size_t allocs = 0;
+    for (auto _ : state) {
+        avl_tree::avl_tree_t<std::string> tree;
+        std::size_t start = alloc_counter::allocations();
+        for (const std::string& key : keys)
+            tree.insert(key);
+        allocs += alloc_counter::allocations() - start;
+        benchmark::DoNotOptimize(tree.get_root());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    set_allocs_counter(state, allocs, state.iterations() * keys.size());
+}
+BENCHMARK(BM_string_insert_copy)->RangeMultiplier(10)->Range(1000, 1000000);
+
+static void BM_string_insert_move(benchmark::State& state) {
+    std::vector<std::string> keys = string_keys(state.range(0));
+    std::size_t allocs = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::vector<std::string> moved = keys;
+        state.ResumeTiming();
+
+        avl_tree::avl_tree_t<std::string> tree;
+        std::size_t start = alloc_counter::allocations();
+        for (std::string& key : moved)
+            tree.insert(std::move(key));
+        allocs += alloc_counter::allocations() - start;
+        benchmark::DoNotOptimize(tree.get_root());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+    set_allocs_counter(state, allocs, state.iterations() * keys.size());
+}
+BENCHMARK(BM_string_insert_move)->RangeMultiplier(10)->Range(1000, 1000000);
+
+template <typename CompT>
+static void BM_string_lookup(benchmark::State& state) {
+    std::vector<std::string> keys = string_keys(state.range(0));
+    avl_tree::avl_tree_t<std::string, CompT> tree{keys.begin(), keys.end()};
+
+    std::vector<std::string> queries = string_keys(1024, 43);
+    for (std::size_t i = 0; i < queries.size(); i += 2)
+        queries[i] = keys[i % keys.size()];
+
+    std::size_t allocs = 0;
+    std::size_t found = 0;
+    std::size_t i = 0;
+    for (auto _ : state) {
+        std::string_view query = queries[i++ % queries.size()];
+        std::size_t start = alloc_counter::allocations();
+        if constexpr (requires { typename CompT::is_transparent; })
+            found += tree.view().contains(query);
+        else
+            found += tree.view().contains(std::string{query});
+        allocs += alloc_counter::allocations() - start;
+    }
+    benchmark::DoNotOptimize(found);
+    state.SetItemsProcessed(state.iterations());
+    set_allocs_counter(state, allocs, state.iterations());
+}
+BENCHMARK(BM_string_lookup<std::less<std::string>>)->RangeMultiplier(10)->Range(1000, 1000000);
+BENCHMARK(BM_string_lookup<std::less<>>)->RangeMultiplier(10)->Range(1000, 1000000);
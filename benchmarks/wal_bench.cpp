@@ -0,0 +1,82 @@
+#include "bench_common.hpp"
+#include "perm_tree.hpp"
+#include "wal.hpp"
+#include <filesystem>
+
+// cost of logging with wal::store_t: inserts with an fsync every range(0)
+// commands, and recovery of a checkpoint of 10^6 keys with a log of range(0)
+// commands after it
+
+namespace {
+    using tree_t    = perm_tree::perm_tree_t<int>;
+    using command_t = command_log::command_t<int>;
+
+    constexpr std::size_t tree_size = 1000000;
+
+    std::filesystem::path bench_dir() {
+        auto dir = std::filesystem::temp_directory_path() / "perm_tree_bench_wal";
+        std::filesystem::remove_all(dir);
+        return dir;
+    }
+
+    command_t insert_command(int key) {
+        command_t command;
+        command.opcode = command_log::opcode_t::insert;
+        command.key    = key;
+        return command;
+    }
+}
+
+static void BM_wal_insert(benchmark::State& state) {
+    std::vector<int> keys = bench::random_keys(1 << 20);
+    auto dir = bench_dir();
+
+    tree_t tree;
+    wal::store_t<tree_t> store{dir.string(), tree, static_cast<std::size_t>(state.range(0))};
+    std::size_t i = 0;
+    for (auto _ : state) {
+        command_t command = insert_command(keys[i++ % keys.size()]);
+        store.append(command);
+        wal::apply(tree, command);
+    }
+    store.commit();
+    state.SetItemsProcessed(state.iterations());
+    std::filesystem::remove_all(dir);
+}
+BENCHMARK(BM_wal_insert)->Arg(1)->Arg(16)->Arg(256)->Arg(4096)->UseRealTime();
+
+// the same inserts without a log, the baseline of BM_wal_insert
+static void BM_wal_insert_off(benchmark::State& state) {
+    std::vector<int> keys = bench::random_keys(1 << 20);
+    tree_t tree;
+    std::size_t i = 0;
+    for (auto _ : state)
+        wal::apply(tree, insert_command(keys[i++ % keys.size()]));
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_wal_insert_off);
+
+static void BM_wal_recover(benchmark::State& state) {
+    std::vector<int> keys = bench::random_keys(tree_size + state.range(0));
+    auto dir = bench_dir();
+    {
+        tree_t tree{keys.begin(), keys.begin() + tree_size};
+        wal::store_t<tree_t> store{dir.string(), tree, 4096};
+        for (std::size_t i = tree_size; i < keys.size(); ++i) {
+            command_t command = insert_command(keys[i]);
+            store.append(command);
+            wal::apply(tree, command);
+        }
+        store.commit();
+    }
+
+    for (auto _ : state) {
+        tree_t tree;
+        wal::store_t<tree_t> store{dir.string(), tree};
+        benchmark::DoNotOptimize(tree.get_root());
+        state.counters["replayed"] = store.replayed();
+    }
+    std::filesystem::remove_all(dir);
+}
+BENCHMARK(BM_wal_recover)->Arg(0)->Arg(10000)->Arg(100000)->Arg(1000000)
+                         ->Unit(benchmark::kMillisecond)->UseRealTime();
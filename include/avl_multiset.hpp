@@ -0,0 +1,76 @@
+#pragma once
+
+#include "avl_tree.hpp"
+#include <cstdint>
+#include <iterator>
+
+namespace avl_multiset {
+    using namespace avl_tree;
+
+    // sorted multiset: a node holds a key with the number of its copies, so a
+    // duplicate takes no node and no rebalancing, while size, kth, rank and
+    // count_in_range count every copy. Iterators point to counted_t<KeyT>
+    template <typename KeyT, typename CompT = std::less<KeyT>>
+    class avl_multiset_t final : private avl_tree_t<counted_t<KeyT>, counted_less<KeyT, CompT>> {
+        using base_t    = avl_tree_t<counted_t<KeyT>, counted_less<KeyT, CompT>>;
+        using tree_node = typename base_t::tree_node;
+
+        using base_t::root_;
+        using base_t::insert_node;
+        using base_t::erase_node;
+        using base_t::recount;
+        using base_t::bound_node;
+
+    public:
+        using external_iterator = typename base_t::external_iterator;
+        using tree_view         = typename base_t::tree_view;
+
+        using base_t::view;
+        using base_t::size;
+        using base_t::begin;
+        using base_t::end;
+        using base_t::find;
+        using base_t::kth;
+        using base_t::rank;
+        using base_t::lower_bound;
+        using base_t::upper_bound;
+        using base_t::count_in_range;
+
+    public:
+        avl_multiset_t() {}
+
+        template <std::input_iterator InputIt>
+        avl_multiset_t(InputIt first, InputIt last) {
+            for (; first != last; ++first)
+                insert(*first);
+        }
+
+        // a copy of a key already in the set only changes the counts on its path
+        void insert(const KeyT& key) {
+            if (!recount(root_, key, 1))
+                insert_node(root_, counted_t<KeyT>{key});
+        }
+
+        // erases one copy of key, returns false if there is none
+        bool erase(const KeyT& key) {
+            std::size_t copies = count(key);
+            if (copies == 0)
+                return false;
+
+            if (copies == 1)
+                erase_node(root_, counted_t<KeyT>{key});
+            else
+                recount(root_, key, -1);
+            return true;
+        }
+
+        std::size_t count(const KeyT& key) const {
+            const tree_node* node = bound_node(root_, key);
+            return (node && !CompT()(key, node->key_.key)) ? node->key_.count : 0;
+        }
+
+        bool contains(const KeyT& key) const { return view().contains(key); }
+
+        bool empty() const noexcept { return (root_ == nullptr); }
+    };
+}
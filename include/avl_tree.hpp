@@ -1,30 +1,125 @@
 #pragma once
 
 #include "ANSI_colors.hpp"
+#include "batch_search.hpp"
+#include "parallel_algorithm.hpp"
+#include "tree_stats.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
 #include <iostream>
+#include <iterator>
 #include <list>
-#include <cmath>
 #include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
-#include <unordered_map>
 
 namespace avl_tree {
-    
+
+    // output iterator that drops everything written to it
+    struct discard_iterator final {
+        using difference_type = std::ptrdiff_t;
+
+        template <typename T>
+        discard_iterator& operator=(const T&) noexcept { return *this; }
+
+        discard_iterator& operator*()     noexcept { return *this; }
+        discard_iterator& operator++()    noexcept { return *this; }
+        discard_iterator  operator++(int) noexcept { return *this; }
+    };
+
+    // key of a lookup: KeyT itself or, with a transparent comparator (one with
+    // is_transparent, as std::less<> has), anything it compares with KeyT,
+    // e.g. a std::string_view for std::string keys. Lookups also take const
+    // KeyT&, so without such a comparator other types still convert to KeyT
+    template <typename K, typename KeyT, typename CompT>
+    concept lookup_key = std::same_as<K, KeyT> || requires { typename CompT::is_transparent; };
+
+    // key of a multiset with the number of its copies; a tree of them counts
+    // every copy in its sizes, so kth and rank see the copies, see avl_multiset.hpp
+    template <typename KeyT>
+    struct counted_t final {
+        KeyT key;
+        std::uint32_t count = 1;
+    };
+
+    template <typename T>
+    inline constexpr bool is_counted_v = false;
+
+    template <typename KeyT>
+    inline constexpr bool is_counted_v<counted_t<KeyT>> = true;
+
+    // orders counted_t by their keys with CompT; transparent, so a tree of them
+    // is searched by plain keys
     template <typename KeyT, typename CompT = std::less<KeyT>>
+    struct counted_less final {
+        using is_transparent = void;
+
+        static const KeyT& key_of(const counted_t<KeyT>& counted) noexcept { return counted.key; }
+
+        template <typename K>
+        static const K& key_of(const K& key) noexcept { return key; }
+
+        template <typename L, typename R>
+        bool operator()(const L& lhs, const R& rhs) const { return CompT()(key_of(lhs), key_of(rhs)); }
+    };
+
+    // paths of a batch of insertions stored back to back in one array
+    template <typename KeyT>
+    class insert_paths_t final {
+        std::vector<KeyT> keys_;
+        std::vector<std::size_t> offsets_{0};
+
+    public:
+        using value_type = KeyT;
+
+        void push_back(const KeyT& key) { keys_.push_back(key); }
+        void end_path() { offsets_.push_back(keys_.size()); }
+
+        void reserve(std::size_t paths, std::size_t keys) {
+            offsets_.reserve(paths + 1);
+            keys_.reserve(keys);
+        }
+
+        std::size_t size() const noexcept { return offsets_.size() - 1; }
+        bool empty() const noexcept { return (size() == 0); }
+
+        std::span<const KeyT> operator[](std::size_t i) const {
+            return std::span<const KeyT>{keys_}.subspan(offsets_[i], offsets_[i + 1] - offsets_[i]);
+        }
+
+        // all paths one after another
+        std::span<const KeyT> keys() const noexcept { return keys_; }
+    };
+
+    // StatsT is null_stats_t or tree_stats_t, see tree_stats.hpp
+    template <typename KeyT, typename CompT = std::less<KeyT>, typename StatsT = null_stats_t>
     class avl_tree_t {
     protected:
+        // fields read by searches come first, so for small keys the children
+        // and the key share the first half of a node; with int keys a node
+        // takes 32 bytes and two of them fill a cache line
         struct tree_node final {
+            tree_node* left_  = nullptr;
+            tree_node* right_ = nullptr;
             KeyT key_;
-            int height_ = 1;
-            int Nleft_  = 0;
-            int Nright_ = 0;
-            tree_node* parent_ = nullptr;
-            tree_node* left_   = nullptr;
-            tree_node* right_  = nullptr;
+            std::uint32_t size_ = 1; // keys in the subtree, copies of counted_t keys included
+            std::uint64_t gen_    : 56 = 0;
+            std::uint64_t height_ : 8  = 1;
 
             tree_node(const KeyT& key) : key_(key) {}
-            tree_node(const tree_node* node) : key_  (node->key_), left_(node->left_),
-                                               right_(node->right_) {}
+            tree_node(KeyT&& key) : key_(std::move(key)) {}
+            tree_node(const tree_node* node) : left_  (node->left_),  right_ (node->right_),
+                                               key_   (node->key_),   size_  (node->size_),
+                                               gen_   (0),            height_(node->height_) {}
 
             std::ostream& print(std::ostream& os = std::cerr) const {
                 os << print_lcyan(key_ << "\t(");
@@ -39,151 +134,328 @@ namespace avl_tree {
                 else
                     os << print_lcyan("none" << ",\t");
 
-                if (parent_)
-                    os << print_lcyan(parent_->key_ << ",\t");
-                else
-                    os << print_lcyan("none" << ",\t");
-
-                os << print_lcyan(Nleft_  << ",\t" << Nright_ << ",\t" <<
-                                  height_ << ",\t" << this    << ",\t" <<
-                                  parent_ << ")\n");
+                os << print_lcyan(size_ << ",\t" << height_ << ",\t" << this << ")\n");
                 return os;
             }
         };
 
         class tree_nodes_buffer_t final {
-        public:
-            using list_nodes_t = typename std::list<std::unique_ptr<tree_node>>;
-            using nodes_iter   = typename list_nodes_t::iterator;
-        
-        private:
-            list_nodes_t nodes_;
-            std::unordered_map<KeyT, nodes_iter> map_;
+            static constexpr std::size_t min_slab_size = 64;
+            static constexpr std::size_t max_slab_size = 64 * 1024;
+            // slabs start at a cache line, so small nodes never straddle two
+            static constexpr std::align_val_t slab_alignment{64};
+
+            struct slab_t final {
+                tree_node*  nodes_;
+                std::size_t capacity_;
+                std::size_t used_ = 0;
+            };
+
+            // slabs are freed with the last buffer that refers to them: copies of
+            // a tree share its nodes and keep the arena of the source alive
+            struct arena_t final {
+                std::vector<slab_t> slabs_;
+
+                arena_t() {}
+                arena_t(const arena_t& other) = delete;
+                arena_t& operator=(const arena_t& other) = delete;
+
+                ~arena_t() {
+                    for (auto& slab : slabs_)
+                        free_slab(slab);
+                }
+            };
 
-        public:
-            tree_node* add_node(const KeyT& key) {
-                nodes_.emplace_back(std::make_unique<tree_node>(key));
-                auto iter = std::prev(nodes_.end());
-                map_.emplace(key, iter);
-                return iter->get();
-            }
+            std::shared_ptr<arena_t> arena_;                // new nodes go here
+            std::vector<std::shared_ptr<arena_t>> shared_;  // arenas of the trees copied
+            std::size_t size_ = 0;
+            // erased nodes linked through left_, reused before the slabs grow;
+            // they stay constructed, so slabs are destroyed as a whole
+            tree_node* free_ = nullptr;
 
-            tree_node* add_node(const tree_node* node) {
-                if (node == nullptr)
-                    return nullptr;
+        private:
+            std::vector<slab_t>& slabs() {
+                if (!arena_)
+                    arena_ = std::make_shared<arena_t>();
+                return arena_->slabs_;
+            }
 
-                nodes_.emplace_back(std::make_unique<tree_node>(node));
-                auto iter = std::prev(nodes_.end());
-                map_.emplace(node->key_, iter);
-                return iter->get();
+            void add_slab(std::size_t capacity) {
+                std::vector<slab_t>& slabs = this->slabs();
+                slabs.reserve(slabs.size() + 1);
+                void* nodes = ::operator new(capacity * sizeof(tree_node), slab_alignment);
+                slabs.push_back({static_cast<tree_node*>(nodes), capacity});
             }
 
-            tree_node* get_node(const KeyT& key) {
-                auto iter = map_.find(key);
-                if (iter == map_.end())
-                    return nullptr;
+            static void free_slab(const slab_t& slab) noexcept {
+                std::destroy_n(slab.nodes_, slab.used_);
+                ::operator delete(slab.nodes_, slab.capacity_ * sizeof(tree_node), slab_alignment);
+            }
 
-                return iter->second->get();
+            std::size_t available() const noexcept {
+                if (!arena_ || arena_->slabs_.empty())
+                    return 0;
+                return arena_->slabs_.back().capacity_ - arena_->slabs_.back().used_;
             }
 
-            std::ostream& print(std::ostream& os = std::cerr) const {
-                os << print_lblue("tree_nodes_buffer_t(" << nodes_.size() << "):\n");
-                for (auto it = nodes_.begin(), end = nodes_.end(); it != end; ++it) {
-                    it->get()->print(os);
-                    os << "\n";
+            template <typename ArgT>
+            tree_node* construct_node(ArgT&& arg) {
+                if (free_) {
+                    tree_node* node = std::exchange(free_, free_->left_);
+                    *node = tree_node{std::forward<ArgT>(arg)};
+                    size_++;
+                    return node;
                 }
-                os << "\n";
-                return os;
+
+                if (available() == 0) {
+                    std::size_t capacity = min_slab_size;
+                    if (arena_ && !arena_->slabs_.empty())
+                        capacity = std::min(arena_->slabs_.back().capacity_ * 2, max_slab_size);
+                    add_slab(capacity);
+                }
+
+                slab_t& slab = arena_->slabs_.back();
+                tree_node* node = std::construct_at(slab.nodes_ + slab.used_, std::forward<ArgT>(arg));
+                slab.used_++;
+                size_++;
+                return node;
             }
 
-            void clear() noexcept {
-                nodes_.clear();
-                map_.clear();
+            template <typename FuncT>
+            void for_each_slab(FuncT func) const {
+                if (arena_)
+                    for (auto& slab : arena_->slabs_)
+                        func(slab);
+                for (auto& arena : shared_)
+                    for (auto& slab : arena->slabs_)
+                        func(slab);
             }
 
-            tree_node*    front_ptr() { return  nodes_.front().get(); }
-            tree_node&    back_node() { return *nodes_.back(); }
-            list_nodes_t& get_nodes() { return nodes_; }
-            const list_nodes_t& get_nodes() const { return nodes_; }
-        };
+        public:
+            tree_nodes_buffer_t() {}
 
-        class internal_iterator final {
-            using iterator_category = std::forward_iterator_tag;
-            using value_type        = tree_node;
-            using pointer           = value_type*;
-            using reference         = value_type&;
-            using difference_type   = std::ptrdiff_t;
+            tree_nodes_buffer_t(const tree_nodes_buffer_t& other) = delete;
+            tree_nodes_buffer_t& operator=(const tree_nodes_buffer_t& other) = delete;
 
-            pointer node_ = nullptr;
+            tree_nodes_buffer_t(tree_nodes_buffer_t&& other) noexcept :
+                arena_ (std::move(other.arena_)),
+                shared_(std::move(other.shared_)),
+                size_  (std::exchange(other.size_, 0)),
+                free_  (std::exchange(other.free_, nullptr)) {}
 
-        public:
-            internal_iterator() {}
-            internal_iterator(const internal_iterator& node_it)  : node_(std::addressof(*node_it)) {}
-            internal_iterator(reference node)                    : node_(std::addressof(node))     {}
-            internal_iterator(pointer   node)                    : node_(node)                     {}
+            tree_nodes_buffer_t& operator=(tree_nodes_buffer_t&& other) noexcept {
+                if (this == &other)
+                    return *this;
 
-            internal_iterator& operator=(pointer node) {
-                *this = internal_iterator{node};
+                std::swap(arena_,  other.arena_);
+                std::swap(shared_, other.shared_);
+                std::swap(size_,   other.size_);
+                std::swap(free_,   other.free_);
                 return *this;
             }
 
-            bool is_valid() const noexcept { return (node_ != nullptr); }
+            // empty buffer that keeps every node of this one alive, in O(arenas);
+            // the nodes must not change any more, neither through this buffer nor the new one,
+            // except those only one of the trees of the buffers can reach
+            tree_nodes_buffer_t share() const {
+                tree_nodes_buffer_t buffer;
+                buffer.shared_ = shared_;
+                if (arena_)
+                    buffer.shared_.push_back(arena_);
+                buffer.size_ = size_;
+                return buffer;
+            }
 
-            reference operator*() {
-                if (node_) return *node_;
-                throw std::invalid_argument("*nullptr");
+            tree_node* add_node(const KeyT& key) {
+                return construct_node(key);
             }
 
-            const reference operator*() const {
-                if (node_) return *node_;
-                throw std::invalid_argument("*nullptr");
+            tree_node* add_node(KeyT&& key) {
+                return construct_node(std::move(key));
             }
 
-            pointer operator->()             noexcept { return node_; }
-            const pointer operator->() const noexcept { return node_; }
+            // makes room for count nodes in one slab
+            void reserve(std::size_t count) {
+                if (available() < count)
+                    add_slab(count);
+            }
 
-            bool operator==(const internal_iterator& rhs) const noexcept {
-                return (rhs.node_ == node_);
+            tree_node* add_node(const tree_node* node) {
+                if (node == nullptr)
+                    return nullptr;
+
+                return construct_node(node);
             }
 
-            bool operator!=(const internal_iterator& rhs) const noexcept {
-                return !(rhs.node_ == node_);
+            // node of this buffer that nothing points to any more
+            void free_node(tree_node* node) noexcept {
+                node->left_ = std::exchange(free_, node);
+                size_--;
             }
 
-            internal_iterator& operator++() noexcept {
-                if (is_valid())
-                    node_ = node_->parent_;
-                return *this;
+            // freed nodes and nodes of shared arenas included
+            template <typename FuncT>
+            void for_each(FuncT func) const {
+                for_each_slab([&func](const slab_t& slab) {
+                    for (std::size_t i = 0; i < slab.used_; ++i)
+                        func(const_cast<const tree_node&>(slab.nodes_[i]));
+                });
             }
-        };
 
-        class ascending_range final {
-            internal_iterator node_;
+            std::ostream& print(std::ostream& os = std::cerr) const {
+                os << print_lblue("tree_nodes_buffer_t(" << size_ << "):\n");
+                for_each([&os](const tree_node& node) {
+                    node.print(os);
+                    os << "\n";
+                });
+                os << "\n";
+                return os;
+            }
 
-        public:
-            ascending_range(const internal_iterator& node) : node_(node) {}
-            internal_iterator begin() const { return node_; }
-            internal_iterator end  () const { return internal_iterator{nullptr}; }
+            void release() noexcept {
+                arena_.reset();
+                shared_.clear();
+                size_ = 0;
+                free_ = nullptr;
+            }
+
+            // keeps the first slab, so a buffer that is cleared and refilled
+            // (as the detached branch is) does not go back to the allocator;
+            // an arena shared with a copy is left to it
+            void clear() noexcept {
+                shared_.clear();
+                size_ = 0;
+                free_ = nullptr;
+                if (!arena_ || arena_->slabs_.empty())
+                    return;
+
+                if (arena_.use_count() > 1) {
+                    arena_.reset();
+                    return;
+                }
+
+                std::vector<slab_t>& slabs = arena_->slabs_;
+                slab_t first = slabs.front();
+                std::destroy_n(first.nodes_, first.used_);
+                first.used_ = 0;
+                for (auto it = std::next(slabs.begin()), end = slabs.end(); it != end; ++it)
+                    free_slab(*it);
+                slabs.clear();
+                slabs.push_back(first);
+            }
+
+            // keeps the arenas of other alive as share() would, skipping those this
+            // buffer holds already, so trees that swap nodes back and forth do not
+            // pile them up; nodes of the arenas added count as stored
+            void keep_alive(const tree_nodes_buffer_t& other) {
+                auto add = [this](const std::shared_ptr<arena_t>& arena) {
+                    if (!arena || arena == arena_ || std::find(shared_.begin(), shared_.end(), arena) != shared_.end())
+                        return;
+
+                    shared_.push_back(arena);
+                    for (const slab_t& slab : arena->slabs_)
+                        size_ += slab.used_;
+                };
+                add(other.arena_);
+                for (const auto& arena : other.shared_)
+                    add(arena);
+            }
+
+            // takes over the nodes of other, they keep their addresses
+            void splice(tree_nodes_buffer_t&& other) {
+                if (other.arena_) {
+                    if (other.arena_.use_count() == 1) {
+                        std::vector<slab_t>& slabs = this->slabs();
+                        std::vector<slab_t>& other_slabs = other.arena_->slabs_;
+                        slabs.insert(slabs.begin(), other_slabs.begin(), other_slabs.end());
+                        other_slabs.clear();
+                    } else {
+                        shared_.push_back(other.arena_);
+                    }
+                    other.arena_.reset();
+                }
+                shared_.insert(shared_.end(), other.shared_.begin(), other.shared_.end());
+                other.shared_.clear();
+                size_ += std::exchange(other.size_, 0);
+
+                if (tree_node* last = other.free_) {
+                    while (last->left_)
+                        last = last->left_;
+                    last->left_ = std::exchange(free_, std::exchange(other.free_, nullptr));
+                }
+            }
+
+            // nodes in use, freed ones excluded
+            std::size_t size() const noexcept { return size_; }
+
+
+            ~tree_nodes_buffer_t() { release(); }
         };
 
     protected:
+        // Insertion records its path here instead of following parent links,
+        // an AVL tree of 2^31 nodes is at most 45 levels high.
+        static constexpr int max_height = 64;
+
+        // A node may be changed in place only if it was created in the current
+        // generation. freeze() starts a new one: after it every existing node is
+        // immutable and insertions copy the path they touch, which is how
+        // perm_tree_t shares nodes between its versions. A plain tree freezes only
+        // when it is copied: the copy shares all its nodes, so both of them do,
+        // and gen_ may change in a const source. It is atomic, so threads may copy
+        // one const tree, or copy it while others read it, at the same time.
         tree_nodes_buffer_t buffer_;
         tree_node* root_ = nullptr;
+        mutable std::atomic<std::size_t> gen_{0};
+
+        [[no_unique_address]] StatsT stats_;
 
     public:
+        // path of one insertion, kept inline: it never outgrows the tree height
+        class insert_path_t final {
+            std::array<KeyT, max_height> keys_;
+            std::size_t size_ = 0;
+
+        public:
+            using value_type = KeyT;
+
+            void push_back(const KeyT& key) {
+                if (size_ == max_height)
+                    throw std::length_error("insert_path_t is full");
+                keys_[size_++] = key;
+            }
+
+            void clear() noexcept { size_ = 0; }
+
+            std::size_t size()  const noexcept { return size_; }
+            bool        empty() const noexcept { return (size_ == 0); }
+
+            const KeyT& operator[](std::size_t i) const noexcept { return keys_[i]; }
+
+            const KeyT* begin() const noexcept { return keys_.data(); }
+            const KeyT* end()   const noexcept { return keys_.data() + size_; }
+        };
+
+        // in-order iterator over the tree it was taken from. Nodes are shared
+        // between trees, so they have no parent links: ++ and -- go down a
+        // subtree if there is one on their side, otherwise descend from the
+        // root by the key, so a step is O(log n) at worst and a full scan
+        // O(n log n); for_each_in_range() scans in O(n). end() is the null node,
+        // -- on it gives the greatest key. Valid until the tree changes, as a
+        // tree_view is
         class external_iterator final {
+            const tree_node* root_ = nullptr;
+            const tree_node* node_ = nullptr;
+
+        public:
             using iterator_category = std::bidirectional_iterator_tag;
             using value_type        = KeyT;
             using pointer           = const value_type*;
             using reference         = const value_type&;
             using difference_type   = std::ptrdiff_t;
 
-            tree_node* node_;
-
-        public:
-            external_iterator(const internal_iterator& node) : node_(std::addressof(*node)) {}
-            external_iterator(tree_node& node)               : node_(std::addressof(node))  {}
-            external_iterator(tree_node* node)               : node_(node)       {}
+            external_iterator() {}
+            external_iterator(const tree_node* root, const tree_node* node) : root_(root), node_(node) {}
 
             reference operator*() const {
                 if (node_) return node_->key_;
@@ -195,6 +467,65 @@ namespace avl_tree {
                 throw std::invalid_argument("nullptr->");
             }
 
+            external_iterator& operator++() {
+                if (!node_)
+                    throw std::invalid_argument("++ past the end");
+
+                if (node_->right_) {
+                    node_ = leftmost(node_->right_);
+                    return *this;
+                }
+
+                // the successor is the last node left on the way down to node_
+                const tree_node* successor = nullptr;
+                for (const tree_node* current = root_; current && current != node_;) {
+                    if (CompT()(node_->key_, current->key_)) {
+                        successor = current;
+                        current = current->left_;
+                    } else {
+                        current = current->right_;
+                    }
+                }
+                node_ = successor;
+                return *this;
+            }
+
+            external_iterator& operator--() {
+                if (!node_) {
+                    node_ = rightmost(root_);
+                    return *this;
+                }
+
+                if (node_->left_) {
+                    node_ = rightmost(node_->left_);
+                    return *this;
+                }
+
+                const tree_node* predecessor = nullptr;
+                for (const tree_node* current = root_; current && current != node_;) {
+                    if (CompT()(current->key_, node_->key_)) {
+                        predecessor = current;
+                        current = current->right_;
+                    } else {
+                        current = current->left_;
+                    }
+                }
+                node_ = predecessor;
+                return *this;
+            }
+
+            external_iterator operator++(int) {
+                external_iterator old = *this;
+                ++*this;
+                return old;
+            }
+
+            external_iterator operator--(int) {
+                external_iterator old = *this;
+                --*this;
+                return old;
+            }
+
             bool operator==(const external_iterator& rhs) const noexcept {
                 return (rhs.node_ == node_);
             }
@@ -202,243 +533,1255 @@ namespace avl_tree {
             bool operator!=(const external_iterator& rhs) const noexcept {
                 return !(rhs.node_ == node_);
             }
+        };
 
-            external_iterator& operator++() noexcept {
-                if (node_)
-                    node_ = node_->parent_;
-                return *this;
+    private:
+        tree_node* rotate_right(tree_node* node) {
+            stats_.count(event_t::rotate_right);
+            tree_node* left = writable(node->left_);
+            node->left_  = left->right_;
+            left->right_ = node;
+            update_node(node);
+            update_node(left);
+            return left;
+        }
+
+        tree_node* rotate_left(tree_node* node) {
+            stats_.count(event_t::rotate_left);
+            tree_node* right = writable(node->right_);
+            node->right_ = right->left_;
+            right->left_ = node;
+            update_node(node);
+            update_node(right);
+            return right;
+        }
+
+    protected:
+        static int get_node_height(const tree_node* node) noexcept {
+            return node ? node->height_ : 0;
+        }
+
+        static std::size_t get_node_size(const tree_node* node) noexcept {
+            return node ? node->size_ : 0;
+        }
+
+        // keys a node holds: the copies of a counted_t key, 1 otherwise
+        static std::size_t key_weight(const KeyT& key) noexcept {
+            if constexpr (is_counted_v<KeyT>)
+                return key.count;
+            else
+                return 1;
+        }
+
+        static void update_node(tree_node* node) noexcept {
+            node->height_ = std::max(get_node_height(node->left_), get_node_height(node->right_)) + 1;
+            node->size_   = get_node_size(node->left_) + get_node_size(node->right_) + key_weight(node->key_);
+        }
+
+        // returns the new root of the subtree, node is writable; after an insertion
+        // rotations relink nodes of its path only, after an erase they may also
+        // take a sibling of the path, which is copied if frozen
+        tree_node* balance(tree_node* node) {
+            int balance_diff = get_node_height(node->left_) - get_node_height(node->right_);
+            if (balance_diff > 1) {
+                tree_node* left = node->left_;
+                if (get_node_height(left->left_) < get_node_height(left->right_))
+                    node->left_ = rotate_left(writable(left));
+                return rotate_right(node);
+
+            } else if (balance_diff < -1) {
+                tree_node* right = node->right_;
+                if (get_node_height(right->left_) > get_node_height(right->right_))
+                    node->right_ = rotate_right(writable(right));
+                return rotate_left(node);
             }
+            return node;
+        }
 
-            external_iterator& operator--() noexcept {
-                if (node_)
-                    node_ = node_->right_.get();
-                return *this;
+        // returns the new generation
+        std::size_t freeze() const noexcept { return gen_.fetch_add(1, std::memory_order_relaxed) + 1; }
+
+        // nodes are published to other threads by whatever publishes the tree,
+        // gen_ itself orders nothing
+        std::size_t generation() const noexcept { return gen_.load(std::memory_order_relaxed); }
+
+        // comparator call of insertion, counted by the stats policy
+        bool less(const KeyT& lhs, const KeyT& rhs) noexcept(noexcept(CompT()(lhs, rhs))) {
+            stats_.count(event_t::compare);
+            return CompT()(lhs, rhs);
+        }
+
+        // key is a KeyT, moved into the node if it is an rvalue
+        template <typename K>
+        tree_node* make_node(K&& key) {
+            stats_.count(event_t::node_alloc);
+            tree_node* node = buffer_.add_node(std::forward<K>(key));
+            node->gen_ = generation();
+            if constexpr (is_counted_v<KeyT>)
+                node->size_ = node->key_.count;
+            return node;
+        }
+
+        tree_node* writable(tree_node* node) {
+            if (node->gen_ == generation())
+                return node;
+
+            stats_.count(event_t::node_copy);
+            tree_node* copy = buffer_.add_node(node);
+            copy->gen_ = generation();
+            return copy;
+        }
+
+        // inserts key into the tree rooted at root and returns the node holding it,
+        // an rvalue key is moved into a new node; keys of the nodes passed on the
+        // way down are written to path
+        template <typename K, typename OutputIt>
+            requires std::same_as<std::remove_cvref_t<K>, KeyT>
+        tree_node* insert_node(tree_node*& root, K&& key, OutputIt& path) {
+            stats_.count(event_t::insert);
+            phase_timer_t<StatsT> timer{stats_, phase_t::descent};
+
+            tree_node* nodes[max_height];
+            bool       to_left[max_height];
+            int depth = 0;
+
+            for (tree_node* current = root; current; ++depth) {
+                if (less(key, current->key_))
+                    to_left[depth] = true;
+                else if (less(current->key_, key))
+                    to_left[depth] = false;
+                else
+                    return current;
+
+                *path++ = current->key_;
+
+                nodes[depth] = current;
+                current = to_left[depth] ? current->left_ : current->right_;
             }
 
-            external_iterator operator--(int) noexcept {
-                auto tmp = *this;
-                if (node_)
-                    node_ = node_->left_.get();
-                return tmp;
+            // one pass up the path: every ancestor gains a key on the side we came
+            // from, but heights only change until the first node whose height stays
+            // the same or which is rotated back to its old height
+            timer.next(phase_t::update);
+            tree_node* destination = make_node(std::forward<K>(key));
+            std::size_t weight = destination->size_;
+            tree_node* child = destination;
+            bool height_changed = true;
+            while (depth-- > 0) {
+                stats_.count(event_t::ancestor_update);
+                tree_node* node = writable(nodes[depth]);
+                if (to_left[depth])
+                    node->left_ = child;
+                else
+                    node->right_ = child;
+                node->size_ += weight;
+
+                child = node;
+                if (!height_changed)
+                    continue;
+
+                stats_.count(event_t::height_update);
+                int old_height = node->height_;
+                node->height_ = std::max(get_node_height(node->left_), get_node_height(node->right_)) + 1;
+                child = balance(node);
+                height_changed = (child->height_ != old_height);
             }
-        };
+            root = child;
 
-    private:
-        static void rotate_right(tree_node* node, tree_node*& root) {
-            if (!node)
-                return;
+            return destination;
+        }
 
-            tree_node* node_left_old = node->left_;
+        template <typename K>
+            requires std::same_as<std::remove_cvref_t<K>, KeyT>
+        tree_node* insert_node(tree_node*& root, K&& key) {
+            discard_iterator path;
+            return insert_node(root, std::forward<K>(key), path);
+        }
+
+        // erases key from the tree rooted at root, returns false if there is no such key;
+        // keys of the nodes passed before reaching it are written to path
+        template <typename OutputIt>
+        bool erase_node(tree_node*& root, const KeyT& key, OutputIt& path) {
+            stats_.count(event_t::erase);
+
+            tree_node* nodes[max_height];
+            bool       to_left[max_height];
+            int depth = 0;
+
+            tree_node* erased = root;
+            while (erased) {
+                if (less(key, erased->key_))
+                    to_left[depth] = true;
+                else if (less(erased->key_, key))
+                    to_left[depth] = false;
+                else
+                    break;
 
-            node->left_ = node->left_->right_;
-            node_left_old->right_ = node;
+                *path++ = erased->key_;
 
-            if (node == root) {
-                root = node_left_old;
-            } else {
-                if (CompT()(node->key_, node->parent_->key_))
-                    node->parent_->left_  = node_left_old;
+                nodes[depth] = erased;
+                erased = to_left[depth++] ? erased->left_ : erased->right_;
+            }
+            if (!erased)
+                return false;
+
+            // a node with two children is replaced by its successor, which is
+            // taken from the bottom of the right subtree
+            int erased_depth = depth;
+            tree_node* successor = nullptr;
+            tree_node* child = erased->left_ ? erased->left_ : erased->right_;
+            if (erased->left_ && erased->right_) {
+                nodes[depth]   = erased;
+                to_left[depth] = false;
+                successor = erased->right_;
+                while (successor->left_) {
+                    nodes[++depth] = successor;
+                    to_left[depth] = true;
+                    successor = successor->left_;
+                }
+                child = successor->right_;
+                ++depth;
+            }
+
+            // one pass up the path, heights may change up to the root
+            while (depth-- > 0) {
+                stats_.count(event_t::ancestor_update);
+                tree_node* node;
+                if (depth == erased_depth) {
+                    node = writable(successor);
+                    node->left_  = erased->left_;
+                    node->right_ = erased->right_;
+                } else {
+                    node = writable(nodes[depth]);
+                }
+
+                if (to_left[depth])
+                    node->left_ = child;
                 else
-                    node->parent_->right_ = node_left_old;
+                    node->right_ = child;
+
+                update_node(node);
+                child = balance(node);
             }
+            root = child;
 
-            node_left_old->parent_ = node->parent_;
-            if (node->left_)
-                node->left_->parent_ = node;
-            node->parent_ = node_left_old;
+            // a node of the current generation is in no other tree
+            if (erased->gen_ == generation()) {
+                stats_.count(event_t::node_free);
+                buffer_.free_node(erased);
+            }
+            return true;
+        }
 
-            update_height(node);
-            update_Nchilds(node);
+        bool erase_node(tree_node*& root, const KeyT& key) {
+            discard_iterator path;
+            return erase_node(root, key, path);
         }
 
-        static void rotate_left(tree_node* node, tree_node*& root) {
+        // adds delta to the copies of key, a counted_t one, in the tree rooted at
+        // root; returns false if there is no such key. The shape stays the same,
+        // only the sizes on the path change
+        template <typename K>
+        bool recount(tree_node*& root, const K& key, std::int64_t delta) requires is_counted_v<KeyT> {
+            tree_node* nodes[max_height];
+            bool       to_left[max_height];
+            int depth = 0;
+
+            tree_node* counted = root;
+            while (counted) {
+                if (CompT()(key, counted->key_))
+                    to_left[depth] = true;
+                else if (CompT()(counted->key_, key))
+                    to_left[depth] = false;
+                else
+                    break;
+
+                nodes[depth] = counted;
+                counted = to_left[depth++] ? counted->left_ : counted->right_;
+            }
+            if (!counted)
+                return false;
+
+            tree_node* child = writable(counted);
+            child->key_.count += delta;
+            child->size_      += delta;
+            while (depth-- > 0) {
+                tree_node* node = writable(nodes[depth]);
+                if (to_left[depth])
+                    node->left_ = child;
+                else
+                    node->right_ = child;
+                node->size_ += delta;
+                child = node;
+            }
+            root = child;
+            return true;
+        }
+
+        static tree_node* clone_subtree(tree_nodes_buffer_t& buffer, const tree_node* node, std::size_t gen) {
             if (!node)
-                return;
+                return nullptr;
 
-            tree_node* node_right_old = node->right_;
+            tree_node* copy = buffer.add_node(node);
+            copy->gen_   = gen;
+            copy->left_  = clone_subtree(buffer, node->left_,  gen);
+            copy->right_ = clone_subtree(buffer, node->right_, gen);
+            return copy;
+        }
 
-            node->right_ = node->right_->left_;
-            node_right_old->left_ = node;
+        // clones a tree sharing nodes with the one rooted at old_root, which was
+        // cloned to new_root: a shared node is found by descending both trees by
+        // its key, as no other node of the old tree holds an equal one
+        static tree_node* clone_sharing(tree_nodes_buffer_t& buffer, const tree_node* node, std::size_t gen,
+                                        const tree_node* old_root, tree_node* new_root) {
+            if (!node)
+                return nullptr;
 
-            if (node == root) {
-                root = node_right_old;
-            } else {
-                if (CompT()(node->key_, node->parent_->key_))
-                    node->parent_->left_  = node_right_old;
-                else
-                    node->parent_->right_ = node_right_old;
-            }
+            const tree_node* old_node = old_root;
+            tree_node* new_node = new_root;
+            while (old_node && old_node != node) {
+                bool to_right = CompT()(old_node->key_, node->key_);
+                if (!to_right && !CompT()(node->key_, old_node->key_))
+                    break;
 
-            node_right_old->parent_ = node->parent_;
-            if (node->right_)
-                node->right_->parent_ = node;
-            node->parent_ = node_right_old;
-            
-            update_height(node);
-            update_Nchilds(node);
+                old_node = to_right ? old_node->right_ : old_node->left_;
+                new_node = to_right ? new_node->right_ : new_node->left_;
+            }
+            if (old_node == node)
+                return new_node;
+
+            tree_node* copy = buffer.add_node(node);
+            copy->gen_   = gen;
+            copy->left_  = clone_sharing(buffer, node->left_,  gen, old_root, new_root);
+            copy->right_ = clone_sharing(buffer, node->right_, gen, old_root, new_root);
+            return copy;
         }
 
-    protected:
-        static int get_node_size(internal_iterator node) noexcept {
-            if (!node.is_valid())
-                return 0;
+        static const tree_node* leftmost(const tree_node* node) noexcept {
+            while (node && node->left_)
+                node = node->left_;
+            return node;
+        }
 
-            return node->Nleft_ + node->Nright_ + 1;
+        static const tree_node* rightmost(const tree_node* node) noexcept {
+            while (node && node->right_)
+                node = node->right_;
+            return node;
         }
 
-        static void update_Nchilds(internal_iterator node) {
-            for (auto& node_ : ascending_range{node}) {
-                node_.Nleft_  = get_node_size(node_.left_);
-                node_.Nright_ = get_node_size(node_.right_);
+        static const tree_node* kth_node(const tree_node* node, std::size_t k) noexcept {
+            while (node) {
+                std::size_t left_size = get_node_size(node->left_);
+                if (k < left_size) {
+                    node = node->left_;
+                } else if (k - left_size >= key_weight(node->key_)) {
+                    k -= left_size + key_weight(node->key_);
+                    node = node->right_;
+                } else {
+                    return node;
+                }
             }
+            return nullptr;
         }
 
-        static void update_height(internal_iterator node) {
-            for (auto& node_ : ascending_range{node}) {
-                node_.height_ = 0;
-                if (node_.left_)
-                    node_.height_ = node_.left_->height_;
-                if (node_.right_)
-                    node_.height_ = std::max(node_.height_, node_.right_->height_);
+        // number of keys less than key (or not greater, if or_equal)
+        template <typename K>
+        static std::size_t count_less(const tree_node* node, const K& key, bool or_equal = false) {
+            std::size_t count = 0;
+            while (node) {
+                bool go_right = or_equal ? !CompT()(key, node->key_) : CompT()(node->key_, key);
+                if (go_right) {
+                    count += get_node_size(node->left_) + key_weight(node->key_);
+                    node = node->right_;
+                } else {
+                    node = node->left_;
+                }
+            }
+            return count;
+        }
 
-                node_.height_++;
+        // first node whose key is not less than key (or greater than key, if strict)
+        template <typename K>
+        static const tree_node* bound_node(const tree_node* node, const K& key, bool strict = false) {
+            const tree_node* bound = nullptr;
+            while (node) {
+                bool go_left = strict ? CompT()(key, node->key_) : !CompT()(node->key_, key);
+                if (go_left) {
+                    bound = node;
+                    node = node->left_;
+                } else {
+                    node = node->right_;
+                }
             }
+            return bound;
         }
 
-        static void balance(internal_iterator node, tree_node*& root) {
-            if (!node.is_valid())
-                return;
+        // builds a perfectly balanced tree of the next count distinct keys, in order
+        template <typename InputIt>
+        tree_node* build_subtree(InputIt& current, InputIt last, std::size_t count) {
+            if (count == 0)
+                return nullptr;
 
-            int balance_diff = 0;
-            if (node->left_)
-                balance_diff = node->left_->height_;
-            if (node->right_)
-                balance_diff -= node->right_->height_;
+            std::size_t left_count = count / 2;
+            tree_node* left = build_subtree(current, last, left_count);
 
-            int left_height = 0;
-            int right_height = 0;
-            if (balance_diff > 1) {
-                tree_node* left = node->left_;
-                if (left->left_)
-                    left_height = left->left_->height_;
+            tree_node* node = make_node(*current);
+            while (current != last && !CompT()(node->key_, *current))
+                ++current;
 
-                if (left->right_)
-                    right_height = left->right_->height_;
+            node->left_  = left;
+            node->right_ = build_subtree(current, last, count - left_count - 1);
+            update_node(node);
+            return node;
+        }
 
-                if (left_height < right_height)
-                    rotate_left(node->left_, root);
-                rotate_right(std::addressof(*node), root);
-                    
-            } else if (balance_diff < -1) {
-                tree_node* right = node->right_;
-                if (right->left_)
-                    left_height = right->left_->height_;
+        // Join-based algorithms (Blelloch, Ferizovic, Sun) build their result
+        // from nodes of this tree, changed in place when they are of generation
+        // gen and copied otherwise, and from copies of nodes of other trees,
+        // which are only read. New nodes go to buffer, so parallel branches
+        // use buffers of their own and splice them afterwards.
+        struct join_context_t final {
+            tree_nodes_buffer_t& buffer;
+            std::size_t gen;
+
+            struct split_t final {
+                tree_node* left  = nullptr;
+                tree_node* found = nullptr; // node with the key, detached
+                tree_node* right = nullptr;
+            };
+
+            tree_node* copy(const tree_node* node) const {
+                tree_node* copy = buffer.add_node(node);
+                copy->gen_ = gen;
+                return copy;
+            }
+
+            tree_node* writable(tree_node* node) const {
+                return (node->gen_ == gen) ? node : copy(node);
+            }
 
-                if (right->right_)
-                    right_height = right->right_->height_;
+            tree_node* clone(const tree_node* node) const { return clone_subtree(buffer, node, gen); }
 
-                if (left_height > right_height)
-                    rotate_right(node->right_, root);
-                rotate_left(std::addressof(*node), root);
+            tree_node* rotate_left(tree_node* node) const {
+                tree_node* right = writable(node->right_);
+                node->right_ = right->left_;
+                right->left_ = node;
+                update_node(node);
+                update_node(right);
+                return right;
             }
-        }
 
-        std::ostream& print_subtree(std::ostream& os, internal_iterator node) const {
-            if (!node.is_valid())
-                return os;
+            tree_node* rotate_right(tree_node* node) const {
+                tree_node* left = writable(node->left_);
+                node->left_  = left->right_;
+                left->right_ = node;
+                update_node(node);
+                update_node(left);
+                return left;
+            }
 
-            int used_size = std::pow(2, std::log2(get_node_size(node)) + 1);
-            std::vector<bool> used(used_size, false);
+            // left is taller by more than one level: middle and right go down
+            // its right spine to the first subtree they balance with
+            tree_node* join_right(tree_node* left, tree_node* middle, tree_node* right) const {
+                tree_node* node = writable(left);
+                int right_height = get_node_height(right);
+                if (get_node_height(node->right_) <= right_height + 1) {
+                    middle->left_  = node->right_;
+                    middle->right_ = right;
+                    update_node(middle);
+                    if (get_node_height(middle) > get_node_height(node->left_) + 1)
+                        middle = rotate_right(middle);
+                } else {
+                    middle = join_right(node->right_, middle, right);
+                }
 
-            internal_iterator current = node;
-            int current_index = 1;
-            while (current.is_valid()) {
+                node->right_ = middle;
+                update_node(node);
+                if (get_node_height(middle) > get_node_height(node->left_) + 1)
+                    return rotate_left(node);
+                return node;
+            }
 
-                internal_iterator left_it = current->left_;
-                if (left_it.is_valid() &&
-                    !used[current_index * 2]) {
-                    current = current->left_;
-                    current_index = current_index * 2;
-                    continue;
+            tree_node* join_left(tree_node* left, tree_node* middle, tree_node* right) const {
+                tree_node* node = writable(right);
+                int left_height = get_node_height(left);
+                if (get_node_height(node->left_) <= left_height + 1) {
+                    middle->left_  = left;
+                    middle->right_ = node->left_;
+                    update_node(middle);
+                    if (get_node_height(middle) > get_node_height(node->right_) + 1)
+                        middle = rotate_left(middle);
+                } else {
+                    middle = join_left(left, middle, node->left_);
+                }
+
+                node->left_ = middle;
+                update_node(node);
+                if (get_node_height(middle) > get_node_height(node->right_) + 1)
+                    return rotate_right(node);
+                return node;
+            }
+
+            // keys of left < key of middle < keys of right, middle is writable
+            tree_node* join(tree_node* left, tree_node* middle, tree_node* right) const {
+                int left_height  = get_node_height(left);
+                int right_height = get_node_height(right);
+                if (left_height > right_height + 1)
+                    return join_right(left, middle, right);
+                if (right_height > left_height + 1)
+                    return join_left(left, middle, right);
+
+                middle->left_  = left;
+                middle->right_ = right;
+                update_node(middle);
+                return middle;
+            }
+
+            // the greatest node of node, detached, and the rest of the tree
+            std::pair<tree_node*, tree_node*> split_last(tree_node* node) const {
+                if (!node->right_)
+                    return {node->left_, writable(node)};
+
+                auto [rest, last] = split_last(node->right_);
+                return {join(node->left_, writable(node), rest), last};
+            }
+
+            tree_node* join(tree_node* left, tree_node* right) const {
+                if (!left)
+                    return right;
+
+                auto [rest, last] = split_last(left);
+                return join(rest, last, right);
+            }
+
+            split_t split(tree_node* node, const KeyT& key) const {
+                if (!node)
+                    return {};
+
+                if (CompT()(key, node->key_)) {
+                    split_t parts = split(node->left_, key);
+                    parts.right = join(parts.right, writable(node), node->right_);
+                    return parts;
+                }
+                if (CompT()(node->key_, key)) {
+                    split_t parts = split(node->right_, key);
+                    parts.left = join(node->left_, writable(node), parts.left);
+                    return parts;
                 }
+                return {node->left_, writable(node), node->right_};
+            }
+        };
+
+        enum class set_operation_t : int { unite, subtract, intersect };
 
-                if (!used[current_index] && current.is_valid())
-                    current->print(os);
-                used[current_index] = true;
+        // result of the operation on a tree of this tree's nodes and one of other
+        // nodes; both halves go in parallel for fork_depth levels
+        template <set_operation_t Operation>
+        static tree_node* combine(join_context_t context, tree_node* node, const tree_node* other,
+                                  int fork_depth) {
+            if (!node)
+                return (Operation == set_operation_t::unite) ? context.clone(other) : nullptr;
+            if (!other)
+                return (Operation == set_operation_t::intersect) ? nullptr : node;
+
+            auto parts = context.split(node, other->key_);
+
+            tree_node* left;
+            tree_node* right;
+            tree_nodes_buffer_t right_buffer;
+            bool fork = (fork_depth > 0);
+            parallel::invoke(fork,
+                [&] { left = combine<Operation>(context, parts.left, other->left_, fork_depth - 1); },
+                [&] {
+                    join_context_t right_context{fork ? right_buffer : context.buffer, context.gen};
+                    right = combine<Operation>(right_context, parts.right, other->right_, fork_depth - 1);
+                });
+            context.buffer.splice(std::move(right_buffer));
+
+            tree_node* middle = nullptr;
+            if (Operation == set_operation_t::unite)
+                middle = parts.found ? parts.found : context.copy(other);
+            else if (Operation == set_operation_t::intersect)
+                middle = parts.found;
+
+            return middle ? context.join(left, middle, right) : context.join(left, right);
+        }
+
+        // root is root_ or another root of nodes of this tree
+        template <set_operation_t Operation>
+        void combine(tree_node*& root, const avl_tree_t<KeyT, CompT, StatsT>& other, std::size_t threads) {
+            if (this == &other && root == root_) {
+                if (Operation == set_operation_t::subtract)
+                    root = nullptr;
+                return;
+            }
+
+            if (threads == 0)
+                threads = parallel::threads_count(get_node_size(root) + other.size());
+            join_context_t context{buffer_, generation()};
+            root = combine<Operation>(context, root, other.root_, parallel::fork_depth(threads));
+        }
 
-                internal_iterator right_it = current->right_;
-                if (right_it.is_valid() &&
-                    !used[current_index * 2 + 1]) {
-                    current = current->right_;
-                    current_index = current_index * 2 + 1;
+        static std::ostream& print_subtree(std::ostream& os, const tree_node* node) {
+            std::vector<const tree_node*> stack;
+            const tree_node* current = node;
+            while (current || !stack.empty()) {
+                if (current) {
+                    stack.push_back(current);
+                    current = current->left_;
                     continue;
                 }
 
-                current = current->parent_;
-                current_index /= 2;
+                current = stack.back();
+                stack.pop_back();
+                current->print(os);
+                current = current->right_;
             }
             return os;
         }
 
     public:
-        avl_tree_t() {}
+        // read-only copy of a tree in one array, in van Emde Boas order: a subtree
+        // of height h is stored as its top h/2 levels followed by the subtrees below
+        // them, each laid out the same way, so a descent touches O(log_B n) cache
+        // lines for any line size B. The shape is the one of the source tree, so
+        // insert_path() gives the keys an insertion into that tree would pass.
+        class frozen_tree_t final {
+            static constexpr std::uint32_t none = batch_search::none;
+
+            struct frozen_node final {
+                KeyT key_;
+                std::uint32_t children_[2] = {none, none}; // left, right
+            };
 
-        avl_tree_t(const avl_tree_t<KeyT, CompT>& other) {
-            internal_iterator curr_other = other.root_;
-            if (!curr_other.is_valid())
-                return;
+        public:
+            using key_type = KeyT;
+            static constexpr std::size_t node_size = sizeof(frozen_node);
 
-            root_ = buffer_.add_node(other.root_->key_);
-            internal_iterator curr_this = root_;
+            // a tree in the array: index of its root, none if it is empty
+            struct root_t final {
+                std::uint32_t index  = none;
+                std::int32_t  height = 0;
+                std::uint64_t size   = 0;
+            };
 
-            while (curr_other.is_valid()) {
+        private:
+            // nodes_ points into storage_ or into memory of the caller (a mapped file)
+            std::vector<frozen_node> storage_;
+            std::span<const frozen_node> nodes_;
+            root_t root_;
+            root_t detached_;
+            bool has_detached_ = false;
 
-                if (curr_other->left_ && !curr_this->left_) {
-                    curr_other       = curr_other->left_;
-                    curr_this->left_ = buffer_.add_node(curr_other->key_);
-                    curr_this->left_->parent_ = std::addressof(*curr_this);
-                    curr_this        = curr_this->left_;
+            friend class avl_tree_t;
 
-                } else if (curr_other->right_ && !curr_this->right_) {
-                    curr_other        = curr_other->right_;
-                    curr_this->right_ = buffer_.add_node(curr_other->key_);
-                    curr_this->right_->parent_ = std::addressof(*curr_this);
-                    curr_this         = curr_this->right_;
+        private:
+            // node waiting for its place, it becomes the child on side of the node at parent
+            struct entry_t final {
+                const tree_node* node;
+                std::uint32_t parent;
+                int side;
+                int depth;
+            };
+
+            // appends the first height levels below root in van Emde Boas order;
+            // children(entry, index, level) pushes the entries of the children of
+            // the node placed at index, level is a stack shared by all calls
+            template <typename ChildrenT>
+            static void lay_out(entry_t root, int height, std::vector<entry_t>& order, std::vector<entry_t>& level,
+                                ChildrenT& children) {
+                if (height == 1) {
+                    order.push_back(root);
+                    return;
+                }
 
-                } else {
-                    if (curr_other->parent_) {
-                        update_height (curr_this);
-                        update_Nchilds(curr_this);
-                        curr_other = curr_other->parent_;
-                        curr_this  = curr_this->parent_;
+                int top_height = height / 2;
+                std::size_t top = order.size();
+                lay_out(root, top_height, order, level, children);
+
+                // the bottom subtrees hang from the lowest level of the top one
+                std::size_t first = level.size();
+                int leaves = root.depth + top_height - 1;
+                for (std::size_t i = top, end = order.size(); i < end; ++i)
+                    if (order[i].depth == leaves)
+                        children(order[i], static_cast<std::uint32_t>(i), level);
+                std::size_t last = level.size();
+                for (std::size_t i = first; i < last; ++i)
+                    lay_out(level[i], height - top_height, order, level, children);
+                level.resize(first);
+            }
+
+            // nodes under node, not the keys they count
+            static std::size_t count_nodes(const tree_node* node) noexcept {
+                if constexpr (!is_counted_v<KeyT>)
+                    return get_node_size(node);
+                else
+                    return node ? count_nodes(node->left_) + count_nodes(node->right_) + 1 : 0;
+            }
+
+            // index of node if it is in the tree of main, which is stored from
+            // root_.index: both are descended at once, so no node is looked up
+            std::uint32_t main_index(const tree_node* main, const tree_node* node) const {
+                std::uint32_t index = root_.index;
+                while (main && main != node) {
+                    bool to_right = CompT()(main->key_, node->key_);
+                    if (!to_right && !CompT()(node->key_, main->key_))
+                        return none;
+
+                    main  = to_right ? main->right_ : main->left_;
+                    index = storage_[index].children_[to_right];
+                }
+                return main ? index : none;
+            }
+
+        public:
+            frozen_tree_t() {}
+
+            // the detached tree shares nodes with the main one, the shared nodes are
+            // stored once: the main tree comes first, then the nodes of the detached
+            // tree only, both in van Emde Boas order, so a parent always precedes
+            // its children. Sizes count nodes, so with counted_t keys they are the
+            // numbers of distinct keys
+            frozen_tree_t(const tree_node* root, const tree_node* detached = nullptr, bool has_detached = false) :
+                root_{none, get_node_height(root), count_nodes(root)},
+                detached_{none, get_node_height(detached), count_nodes(detached)},
+                has_detached_(has_detached || detached) {
+                std::vector<entry_t> order;
+                std::vector<entry_t> level;
+
+                auto add_children = [](const entry_t& entry, std::uint32_t index, std::vector<entry_t>& level) {
+                    if (entry.node->left_)
+                        level.push_back({entry.node->left_,  index, 0, entry.depth + 1});
+                    if (entry.node->right_)
+                        level.push_back({entry.node->right_, index, 1, entry.depth + 1});
+                };
+
+                order.reserve(root_.size);
+                if (root)
+                    lay_out({root, none, 0, 0}, root_.height, order, level, add_children);
+                if (order.size() >= none)
+                    throw std::length_error("frozen_tree_t: too many keys");
+
+                auto store = [this, &order](std::size_t first) {
+                    for (std::size_t i = first; i < order.size(); ++i) {
+                        storage_.push_back(frozen_node{order[i].node->key_});
+                        if (order[i].parent != none)
+                            storage_[order[i].parent].children_[order[i].side] = static_cast<std::uint32_t>(i);
+                    }
+                };
+                storage_.reserve(order.size());
+                store(0);
+                root_.index = root ? 0 : none;
+
+                // children shared with the main tree are linked to it and not laid out again
+                if (detached && (detached_.index = main_index(root, detached)) == none) {
+                    std::vector<std::pair<std::uint32_t, std::uint32_t>> shared; // (slot, index)
+                    auto add_own_children = [&](const entry_t& entry, std::uint32_t index, std::vector<entry_t>& level) {
+                        const tree_node* children[2] = {entry.node->left_, entry.node->right_};
+                        for (int side = 0; side < 2; ++side) {
+                            if (!children[side])
+                                continue;
+
+                            std::uint32_t main = main_index(root, children[side]);
+                            if (main == none)
+                                level.push_back({children[side], index, side, entry.depth + 1});
+                            else
+                                shared.emplace_back(2 * index + side, main);
+                        }
+                    };
+
+                    std::size_t first = order.size();
+                    lay_out({detached, none, 0, 0}, detached_.height, order, level, add_own_children);
+                    if (order.size() >= none)
+                        throw std::length_error("frozen_tree_t: too many keys");
+
+                    store(first);
+                    for (auto [slot, index] : shared)
+                        storage_[slot / 2].children_[slot % 2] = index;
+                    detached_.index = static_cast<std::uint32_t>(first);
+                }
+                nodes_ = storage_;
+            }
+
+            frozen_tree_t(const frozen_tree_t& other) : storage_(other.storage_), nodes_(other.nodes_),
+                                                        root_(other.root_), detached_(other.detached_),
+                                                        has_detached_(other.has_detached_) {
+                if (!storage_.empty())
+                    nodes_ = storage_;
+            }
+
+            frozen_tree_t& operator=(const frozen_tree_t& other) {
+                if (this == &other)
+                    return *this;
+
+                frozen_tree_t new_tree{other};
+                return *this = std::move(new_tree);
+            }
+
+            frozen_tree_t(frozen_tree_t&& other) noexcept = default;
+            frozen_tree_t& operator=(frozen_tree_t&& other) noexcept = default;
+
+            // one pass over nodes that may come from anywhere: they must be laid out
+            // as the constructor lays them out, every child after its parent (or, for
+            // a node of the detached tree only, in the main tree), no node reached
+            // twice from one tree, and the trees balanced with the heights and sizes
+            // of their roots. The order of the keys is not checked
+            static void check_shape(std::span<const frozen_node> nodes, root_t root, root_t detached) {
+                auto fail = [](const char* what) { throw std::invalid_argument(std::string{"frozen_tree_t: "} + what); };
+
+                std::size_t main_count = root.size;
+                if (root.index != (main_count ? 0 : none))
+                    fail("main tree is not first");
+
+                enum : std::uint8_t { own_parent = 1, detached_parent = 2 };
+                struct shape_t final {
+                    std::uint64_t size = 0;
+                    int height = 0;
+                    std::uint8_t parents = 0;
+                };
+                std::vector<shape_t> shapes(nodes.size());
+
+                auto check_node = [&](std::size_t i) {
+                    int heights[2] = {0, 0};
+                    std::uint64_t size = 1;
+                    for (int side = 0; side < 2; ++side) {
+                        std::uint32_t child = nodes[i].children_[side];
+                        if (child == none)
+                            continue;
+
+                        bool shared = (i >= main_count && child < main_count);
+                        if (child >= nodes.size() || (!shared && (child <= i || (i < main_count) != (child < main_count))))
+                            fail("child out of place");
+
+                        std::uint8_t parent = shared ? detached_parent : own_parent;
+                        if (shapes[child].parents & parent)
+                            fail("node of two parents");
+                        shapes[child].parents |= parent;
+
+                        size += shapes[child].size;
+                        heights[side] = shapes[child].height;
+                    }
+                    if (std::abs(heights[0] - heights[1]) > 1)
+                        fail("tree out of balance");
+
+                    shapes[i].size   = size;
+                    shapes[i].height = std::max(heights[0], heights[1]) + 1;
+                    if (shapes[i].height > max_height)
+                        fail("tree too high");
+                };
+
+                // children first, and the main tree before the nodes that share it
+                for (std::size_t i = main_count; i-- > 0;)
+                    check_node(i);
+                for (std::size_t i = nodes.size(); i-- > main_count;)
+                    check_node(i);
+
+                auto matches = [&shapes](root_t tree) {
+                    if (tree.index == none)
+                        return tree.size == 0 && tree.height == 0;
+                    return shapes[tree.index].size == tree.size && shapes[tree.index].height == tree.height;
+                };
+                if (!matches(root) || !matches(detached))
+                    fail("heights or sizes differ from the nodes");
+            }
+
+            // tree over nodes that bytes() of another frozen_tree_t gave, e.g. read
+            // from a file or mapped; nothing is copied, so bytes must outlive the tree.
+            // The nodes are checked with check_shape(), in O(n)
+            static frozen_tree_t borrow(std::span<const std::byte> bytes, root_t root,
+                                        root_t detached = {}, bool has_detached = false) {
+                static_assert(std::is_trivially_copyable_v<KeyT>, "frozen_tree_t: keys are stored as bytes");
+
+                if (bytes.size() % sizeof(frozen_node) != 0 ||
+                    reinterpret_cast<std::uintptr_t>(bytes.data()) % alignof(frozen_node) != 0)
+                    throw std::invalid_argument("frozen_tree_t: not an array of nodes");
+
+                std::size_t count = bytes.size() / sizeof(frozen_node);
+                if ((root.index != none && root.index >= count) || (detached.index != none && detached.index >= count))
+                    throw std::invalid_argument("frozen_tree_t: root out of the nodes");
+                if (root.size > count || detached.size > count)
+                    throw std::invalid_argument("frozen_tree_t: more keys than nodes");
+
+                frozen_tree_t tree;
+                tree.nodes_ = {reinterpret_cast<const frozen_node*>(bytes.data()), count};
+                check_shape(tree.nodes_, root, detached);
+                tree.root_         = root;
+                tree.detached_     = detached;
+                tree.has_detached_ = has_detached;
+                return tree;
+            }
+
+            std::span<const std::byte> bytes() const noexcept { return std::as_bytes(nodes_); }
+
+            root_t root()          const noexcept { return root_; }
+            root_t detached_root() const noexcept { return detached_; }
+            bool   has_detached()  const noexcept { return has_detached_; }
+
+            // the detached tree, valid as long as this one is
+            frozen_tree_t detached() const {
+                frozen_tree_t tree;
+                tree.nodes_ = nodes_;
+                tree.root_  = detached_;
+                return tree;
+            }
+
+            std::size_t size() const noexcept { return root_.size; }
+
+            bool empty() const noexcept { return root_.size == 0; }
+
+            int height() const noexcept { return root_.height; }
+
+            bool contains(const KeyT& key) const { return contains<KeyT>(key); }
+
+            template <lookup_key<KeyT, CompT> K>
+            bool contains(const K& key) const {
+                std::uint32_t current = root_.index;
+                while (current != none) {
+                    const frozen_node& node = nodes_[current];
+                    bool to_right = CompT()(node.key_, key);
+                    if (!to_right && !CompT()(key, node.key_))
+                        return true;
+                    current = node.children_[to_right];
+                }
+                return false;
+            }
+
+            // the child is picked by indexing instead of a branch, the only branch
+            // left is the exit on an equal key, which is taken at most once
+            template <std::output_iterator<const KeyT&> OutputIt>
+            OutputIt insert_path(const KeyT& key, OutputIt path) const { return insert_path<KeyT>(key, path); }
+
+            template <lookup_key<KeyT, CompT> K, std::output_iterator<const KeyT&> OutputIt>
+            OutputIt insert_path(const K& key, OutputIt path) const {
+                std::uint32_t current = root_.index;
+                while (current != none) {
+                    const frozen_node& node = nodes_[current];
+                    bool to_right = CompT()(node.key_, key);
+                    if (!to_right && !CompT()(key, node.key_))
+                        break;
+
+                    *path++ = node.key_;
+                    current = node.children_[to_right];
+                }
+                return path;
+            }
+
+            std::list<KeyT> insert_path(const KeyT& key) const { return insert_path<KeyT>(key); }
+
+            template <lookup_key<KeyT, CompT> K>
+            std::list<KeyT> insert_path(const K& key) const {
+                std::list<KeyT> path;
+                insert_path(key, std::back_inserter(path));
+                return path;
+            }
+
+            // i-th path is insert_path() of i-th key; keys go down in groups of
+            // batch_search::lanes, isa_t::avx2 is used for int keys if the CPU has it
+            template <std::input_iterator InputIt>
+            insert_paths_t<KeyT> insert_paths(InputIt first, InputIt last,
+                                              batch_search::isa_t isa = batch_search::isa_t::scalar) const {
+                insert_paths_t<KeyT> paths;
+                if constexpr (std::forward_iterator<InputIt>) {
+                    std::size_t count = std::distance(first, last);
+                    paths.reserve(count, count * root_.height);
+                }
+
+                std::uint32_t root = root_.index;
+                if (!batch_search::supported(isa))
+                    isa = batch_search::isa_t::scalar;
+
+                std::array<KeyT, batch_search::lanes> queries;
+                batch_search::lane_paths_t<KeyT, max_height> lane_paths;
+                while (first != last) {
+                    int count = 0;
+                    for (; first != last && count < batch_search::lanes; ++first)
+                        queries[count++] = *first;
+
+                    descend(root, queries.data(), count, lane_paths, isa);
+                    for (int i = 0; i < count; ++i) {
+                        for (int j = 0; j < lane_paths.sizes[i]; ++j)
+                            paths.push_back(lane_paths.keys[i][j]);
+                        paths.end_path();
+                    }
+                }
+                return paths;
+            }
+
+        private:
+            void descend(std::uint32_t root, const KeyT* queries, int count,
+                         batch_search::lane_paths_t<KeyT, max_height>& lane_paths, batch_search::isa_t isa) const {
+#if defined(BATCH_SEARCH_X86) && defined(__GNUC__)
+                if constexpr (std::is_same_v<KeyT, int> && std::is_same_v<CompT, std::less<int>>) {
+                    static_assert(sizeof(frozen_node) == 3 * sizeof(std::int32_t));
+                    if (isa == batch_search::isa_t::avx2) {
+                        const auto* nodes = reinterpret_cast<const std::int32_t*>(nodes_.data());
+                        batch_search::descend_avx2(nodes, root, queries, count, lane_paths);
+                        return;
+                    }
+                }
+#endif
+                batch_search::descend_scalar<CompT>(nodes_.data(), root, queries, count, lane_paths);
+            }
+        };
+
+        class tree_view final {
+            const tree_node* root_ = nullptr;
+
+        public:
+            tree_view() {}
+            tree_view(const tree_node* root) : root_(root) {}
+
+            std::size_t size() const noexcept { return get_node_size(root_); }
+
+            bool empty() const noexcept { return (root_ == nullptr); }
+
+            bool contains(const KeyT& key) const { return contains<KeyT>(key); }
+
+            template <lookup_key<KeyT, CompT> K>
+            bool contains(const K& key) const {
+                const tree_node* current = root_;
+                while (current) {
+                    if (CompT()(key, current->key_))
+                        current = current->left_;
+                    else if (CompT()(current->key_, key))
+                        current = current->right_;
+                    else
+                        return true;
+                }
+                return false;
+            }
+
+            template <std::output_iterator<const KeyT&> OutputIt>
+            OutputIt insert_path(const KeyT& key, OutputIt path) const { return insert_path<KeyT>(key, path); }
+
+            template <lookup_key<KeyT, CompT> K, std::output_iterator<const KeyT&> OutputIt>
+            OutputIt insert_path(const K& key, OutputIt path) const {
+                const tree_node* current = root_;
+                while (current) {
+                    if (CompT()(key, current->key_)) {
+                        *path++ = current->key_;
+                        current = current->left_;
+                    } else if (CompT()(current->key_, key)) {
+                        *path++ = current->key_;
+                        current = current->right_;
                     } else {
                         break;
                     }
                 }
+                return path;
             }
+
+            std::list<KeyT> insert_path(const KeyT& key) const { return insert_path<KeyT>(key); }
+
+            template <lookup_key<KeyT, CompT> K>
+            std::list<KeyT> insert_path(const K& key) const {
+                std::list<KeyT> path;
+                insert_path(key, std::back_inserter(path));
+                return path;
+            }
+
+            // snapshot for read-heavy use, it does not follow later insertions
+            frozen_tree_t frozen() const { return frozen_tree_t{root_}; }
+
+            external_iterator begin() const noexcept { return {root_, leftmost(root_)}; }
+            external_iterator end()   const noexcept { return {root_, nullptr}; }
+
+            external_iterator find(const KeyT& key) const { return find<KeyT>(key); }
+
+            template <lookup_key<KeyT, CompT> K>
+            external_iterator find(const K& key) const {
+                const tree_node* node = bound_node(root_, key);
+                return {root_, (node && !CompT()(key, node->key_)) ? node : nullptr};
+            }
+
+            // k-th smallest key, counting from 0
+            external_iterator kth(std::size_t k) const noexcept { return {root_, kth_node(root_, k)}; }
+
+            // number of keys less than key
+            std::size_t rank(const KeyT& key) const { return count_less(root_, key); }
+
+            template <lookup_key<KeyT, CompT> K>
+            std::size_t rank(const K& key) const { return count_less(root_, key); }
+
+            external_iterator lower_bound(const KeyT& key) const { return {root_, bound_node(root_, key)}; }
+            external_iterator upper_bound(const KeyT& key) const { return {root_, bound_node(root_, key, true)}; }
+
+            template <lookup_key<KeyT, CompT> K>
+            external_iterator lower_bound(const K& key) const { return {root_, bound_node(root_, key)}; }
+
+            template <lookup_key<KeyT, CompT> K>
+            external_iterator upper_bound(const K& key) const { return {root_, bound_node(root_, key, true)}; }
+
+            // number of keys in [first, last]
+            std::size_t count_in_range(const KeyT& first, const KeyT& last) const {
+                return count_in_range<KeyT>(first, last);
+            }
+
+            template <lookup_key<KeyT, CompT> K>
+            std::size_t count_in_range(const K& first, const K& last) const {
+                if (CompT()(last, first))
+                    return 0;
+                return count_less(root_, last, true) - count_less(root_, first);
+            }
+
+            // calls func with every key in [first, last] in order; the path to the
+            // next key is kept on a stack as deep as the tree, so every node is
+            // visited once and nothing is recursive
+            template <typename FuncT>
+            void for_each_in_range(const KeyT& first, const KeyT& last, FuncT func) const {
+                for_each_in_range<KeyT>(first, last, func);
+            }
+
+            template <lookup_key<KeyT, CompT> K, typename FuncT>
+            void for_each_in_range(const K& first, const K& last, FuncT func) const {
+                const tree_node* path[max_height];
+                int depth = 0;
+
+                // nodes not less than first, where the scan turns left
+                auto descend = [&](const tree_node* node) {
+                    while (node) {
+                        if (CompT()(node->key_, first)) {
+                            node = node->right_;
+                        } else {
+                            path[depth++] = node;
+                            node = node->left_;
+                        }
+                    }
+                };
+
+                descend(root_);
+                while (depth > 0) {
+                    const tree_node* node = path[--depth];
+                    if (CompT()(last, node->key_))
+                        return;
+
+                    func(node->key_);
+                    descend(node->right_);
+                }
+            }
+
+            std::ostream& print(std::ostream& os = std::cerr) const {
+                if (!root_)
+                    return os;
+
+                os << print_lblue("Tree view with root = " << root_->key_ << "(" << root_ << ")" <<
+                                  ":\nkey(<child>, <child>, <size>, <height>, <ptr>):\n");
+                return print_subtree(os, root_);
+            }
+        };
+
+    protected:
+        // sizes and heights of a subtree whose nodes have height 0 until updated
+        static void update_subtree(tree_node* node) noexcept {
+            if (!node || node->height_ != 0)
+                return;
+
+            update_subtree(node->left_);
+            update_subtree(node->right_);
+            update_node(node);
+        }
+
+        // builds the nodes of frozen in buffer_ in the order they are stored there,
+        // all of them or only those of the main tree; returns the roots of the main
+        // and the detached trees. borrow() checks the shape of the trees, not the
+        // order of their keys, so a file of another program may still make trees
+        // that are not search trees
+        std::pair<tree_node*, tree_node*> thaw(const frozen_tree_t& frozen, bool with_detached) {
+            constexpr std::uint32_t none = batch_search::none;
+
+            // the main tree comes first unless frozen is a detached() one
+            auto nodes = frozen.nodes_;
+            std::size_t main_count = std::min<std::size_t>(frozen.root_.size, nodes.size());
+            std::size_t count = (with_detached || frozen.root_.index != 0) ? nodes.size() : main_count;
+            if (count == 0)
+                return {nullptr, nullptr};
+
+            // one slab for all nodes, so the node stored at i is first + i
+            buffer_.reserve(count);
+            tree_node* first = make_node(nodes[0].key_);
+            for (std::size_t i = 1; i < count; ++i)
+                make_node(nodes[i].key_);
+
+            auto node_at = [first, count](std::uint32_t index) -> tree_node* {
+                if (index == none)
+                    return nullptr;
+                if (index >= count)
+                    throw std::invalid_argument("frozen_tree_t: child out of the nodes");
+                return first + index;
+            };
+
+            for (std::size_t i = 0; i < count; ++i) {
+                first[i].left_   = node_at(nodes[i].children_[0]);
+                first[i].right_  = node_at(nodes[i].children_[1]);
+                first[i].height_ = 0;
+            }
+
+            tree_node* root     = node_at(frozen.root_.index);
+            tree_node* detached = with_detached ? node_at(frozen.detached_.index) : nullptr;
+            if (frozen.root_.index == 0) {
+                // parents precede their children in the main tree and in the nodes
+                // after it, so going backwards updates children first
+                for (std::size_t i = main_count; i-- > 0;)
+                    update_node(first + i);
+                for (std::size_t i = count; i-- > main_count;)
+                    update_node(first + i);
+            } else {
+                update_subtree(root);
+                update_subtree(detached);
+            }
+            return {root, detached};
+        }
+
+    public:
+        avl_tree_t() {}
+
+        // the main tree of frozen, e.g. of a tree_file::mapped_tree_t; it is built
+        // in one pass with the nodes in the order frozen stores them
+        explicit avl_tree_t(const frozen_tree_t& frozen) { root_ = thaw(frozen, false).first; }
+
+        // keys may come in any order, they are sorted in parallel first
+        template <std::input_iterator InputIt>
+        avl_tree_t(InputIt first, InputIt last) {
+            std::vector<KeyT> keys(first, last);
+            parallel::sort(keys.begin(), keys.end(), CompT());
+            build_from_sorted(keys.begin(), keys.end());
+        }
+
+        // O(1): the copy shares the nodes of other, and each tree copies
+        // the paths it changes from now on
+        avl_tree_t(const avl_tree_t<KeyT, CompT, StatsT>& other) : buffer_(other.buffer_.share()),
+                                                                    root_  (other.root_) {
+            gen_.store(other.freeze(), std::memory_order_relaxed);
         }
 
-        avl_tree_t<KeyT, CompT>& operator=(const avl_tree_t<KeyT, CompT>& other) {
+        avl_tree_t<KeyT, CompT, StatsT>& operator=(const avl_tree_t<KeyT, CompT, StatsT>& other) {
             if (this == &other)
                 return *this;
 
-            avl_tree_t<KeyT, CompT> new_tree{other};
+            avl_tree_t<KeyT, CompT, StatsT> new_tree{other};
             buffer_ = std::move(new_tree.buffer_);
             root_   = std::move(new_tree.root_);
+            gen_.store(new_tree.generation(), std::memory_order_relaxed);
             return *this;
         }
 
-        avl_tree_t(avl_tree_t<KeyT, CompT>&& other) noexcept : buffer_ (std::move(other.buffer_)),
-                                                               root_   (std::move(other.root_)) {
+        avl_tree_t(avl_tree_t<KeyT, CompT, StatsT>&& other) noexcept : buffer_ (std::move(other.buffer_)),
+                                                                       root_   (std::move(other.root_)),
+                                                                       gen_    (other.generation()),
+                                                                       stats_  (other.stats_) {
             other.root_ = nullptr;
         }
         
-        avl_tree_t& operator=(avl_tree_t<KeyT, CompT>&& other) noexcept {
+        avl_tree_t& operator=(avl_tree_t<KeyT, CompT, StatsT>&& other) noexcept {
             if (this == &other)
                 return *this;
 
             std::swap(buffer_, other.buffer_);
             std::swap(root_,   other.root_);
+            std::size_t gen = generation();
+            gen_.store(other.generation(), std::memory_order_relaxed);
+            other.gen_.store(gen, std::memory_order_relaxed);
+            std::swap(stats_,  other.stats_);
             return *this;
         }
 
@@ -447,63 +1790,158 @@ namespace avl_tree {
                 return os;
 
             os << print_lblue("AVL tree with root = " << root_->key_ << "(" << root_ << ")" <<
-                              ":\nkey(<child>, <child>, <parent>, <Nleft>, <Nright>,"
-                                     "<height>, <ptr>, <parent ptr>):\n");
+                              ":\nkey(<child>, <child>, <size>, <height>, <ptr>):\n");
 
             print_subtree(os, root_);
             return os;
         }
 
         external_iterator insert(const KeyT& key) {
-            tree_node* new_node = buffer_.add_node(key);
+            tree_node* node = insert_node(root_, key);
+            return {root_, node};
+        }
 
-            if (!root_) {
-                root_ = new_node;
-                return root_;
-            }
+        external_iterator insert(KeyT&& key) {
+            tree_node* node = insert_node(root_, std::move(key));
+            return {root_, node};
+        }
 
-            internal_iterator current     = root_;
-            internal_iterator destination = root_;
-            while (current.is_valid()) {
-                if (CompT()(key, current->key_)) {
-                    if (current->left_) {
-                        current = current->left_;
-                    } else {
-                        current->left_ = new_node;
-                        current->left_->parent_ = std::addressof(*current);
-                        destination = current->left_;
-                        break;
-                    }
-                } else if (CompT()(current->key_, key)) {
-                    if (current->right_) {
-                        current = current->right_;
-                    } else {
-                        current->right_ = new_node;
-                        current->right_->parent_ = std::addressof(*current);
-                        destination = current->right_;
-                        break;
-                    }
-                } else {
-                    return current;
-                }
+        // the key is built from args, then moved into its node if it is new
+        template <typename... Args>
+        external_iterator emplace(Args&&... args) {
+            tree_node* node = insert_node(root_, KeyT(std::forward<Args>(args)...));
+            return {root_, node};
+        }
+
+        // returns false if there is no such key; the memory of the node is reused
+        // by the next insertions
+        bool erase(const KeyT& key) {
+            return erase_node(root_, key);
+        }
+
+        // replaces the content with keys of a sorted range in O(n),
+        // equal keys are stored once
+        template <std::forward_iterator ForwardIt>
+        void build_from_sorted(ForwardIt first, ForwardIt last) {
+            std::size_t count = 0;
+            for (ForwardIt prev = first, current = first; current != last; prev = current++) {
+                if (CompT()(*current, *prev))
+                    throw std::invalid_argument("build_from_sorted: range is not sorted");
+                if (current == first || CompT()(*prev, *current))
+                    ++count;
             }
 
-            update_height (destination);
-            update_Nchilds(destination);
+            root_ = nullptr;
+            buffer_.clear();
+            buffer_.reserve(count);
+            root_ = build_subtree(first, last, count);
+        }
 
-            for (auto& node_ : ascending_range{destination})
-                balance(node_, root_);
+        // the tree becomes the union, difference or intersection of it and other
+        // in O(m log(n / m + 1)) for m <= n, on up to threads threads, by default
+        // as many as are worth it for these sizes
+        void unite    (const avl_tree_t<KeyT, CompT, StatsT>& other, std::size_t threads = 0) {
+            combine<set_operation_t::unite>(root_, other, threads);
+        }
 
-            return buffer_.get_node(destination->key_);
+        void subtract (const avl_tree_t<KeyT, CompT, StatsT>& other, std::size_t threads = 0) {
+            combine<set_operation_t::subtract>(root_, other, threads);
+        }
+
+        void intersect(const avl_tree_t<KeyT, CompT, StatsT>& other, std::size_t threads = 0) {
+            combine<set_operation_t::intersect>(root_, other, threads);
+        }
+
+        // appends keys of greater, which must all be greater than the keys of this tree,
+        // in O(log n): the nodes of greater are shared, as a copy shares them, and
+        // this tree keeps the arenas of greater alive
+        void join(const avl_tree_t<KeyT, CompT, StatsT>& greater) {
+            if (!greater.root_)
+                return;
+            if (root_ && !CompT()(*kth(size() - 1), *greater.kth(0)))
+                throw std::invalid_argument("join: keys are not greater");
+
+            // no node of greater may be of the generation this tree changes in place
+            buffer_.keep_alive(greater.buffer_);
+            gen_.store(std::max(generation(), greater.freeze()), std::memory_order_relaxed);
+
+            join_context_t context{buffer_, generation()};
+            root_ = context.join(root_, greater.root_);
+        }
+
+        // keeps keys less than key and returns a tree of the others, in O(log n):
+        // the trees divide the nodes between them and share their arenas
+        avl_tree_t<KeyT, CompT, StatsT> split(const KeyT& key) {
+            auto parts = join_context_t{buffer_, generation()}.split(root_, key);
+            if (parts.found)
+                parts.right = join_context_t{buffer_, generation()}.join(nullptr, parts.found, parts.right);
+
+            // no node is in both trees, so both may change theirs in place
+            avl_tree_t<KeyT, CompT, StatsT> greater;
+            greater.buffer_ = buffer_.share();
+            greater.root_   = parts.right;
+            greater.gen_.store(generation(), std::memory_order_relaxed);
+            root_ = parts.left;
+            return greater;
         }
 
         const tree_node* get_root() const { return const_cast<const tree_node*>(root_); }
 
+        tree_view   view() const noexcept { return tree_view{root_}; }
+        std::size_t size() const noexcept { return view().size(); }
+
+        // van Emde Boas copy of the current tree for read-only path queries
+        frozen_tree_t frozen() const { return view().frozen(); }
+
+        external_iterator begin() const noexcept { return view().begin(); }
+        external_iterator end()   const noexcept { return view().end(); }
+
+        // counters of this tree, all zero unless StatsT is tree_stats_t
+        const StatsT& stats() const noexcept { return stats_; }
+        StatsT&       stats()       noexcept { return stats_; }
+
+        external_iterator kth(std::size_t k) const noexcept { return view().kth(k); }
+        external_iterator find(const KeyT& key) const { return view().find(key); }
+        std::size_t       rank(const KeyT& key) const { return view().rank(key); }
+        external_iterator lower_bound(const KeyT& key) const { return view().lower_bound(key); }
+        external_iterator upper_bound(const KeyT& key) const { return view().upper_bound(key); }
+
+        template <lookup_key<KeyT, CompT> K>
+        external_iterator find(const K& key) const { return view().find(key); }
+
+        template <lookup_key<KeyT, CompT> K>
+        std::size_t rank(const K& key) const { return view().rank(key); }
+
+        template <lookup_key<KeyT, CompT> K>
+        external_iterator lower_bound(const K& key) const { return view().lower_bound(key); }
+
+        template <lookup_key<KeyT, CompT> K>
+        external_iterator upper_bound(const K& key) const { return view().upper_bound(key); }
+
+        std::size_t count_in_range(const KeyT& first, const KeyT& last) const {
+            return view().count_in_range(first, last);
+        }
+
+        template <lookup_key<KeyT, CompT> K>
+        std::size_t count_in_range(const K& first, const K& last) const {
+            return view().count_in_range(first, last);
+        }
+
+        template <typename FuncT>
+        void for_each_in_range(const KeyT& first, const KeyT& last, FuncT func) const {
+            view().for_each_in_range(first, last, func);
+        }
+
+        template <lookup_key<KeyT, CompT> K, typename FuncT>
+        void for_each_in_range(const K& first, const K& last, FuncT func) const {
+            view().for_each_in_range(first, last, func);
+        }
+
         virtual ~avl_tree_t() {}
     };
 
-    template <typename KeyT, typename CompT>
-    std::ostream& operator<<(std::ostream& os, const avl_tree_t<KeyT, CompT>& avl_tree) {
+    template <typename KeyT, typename CompT, typename StatsT>
+    std::ostream& operator<<(std::ostream& os, const avl_tree_t<KeyT, CompT, StatsT>& avl_tree) {
         return avl_tree.print(os);
     }
 }
\ No newline at end of file
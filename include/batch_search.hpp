@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BATCH_SEARCH_X86 1
+#endif
+
+// descents of many keys through a frozen_tree_t at once: a group of lanes keys
+// advances one level per step, and the next node of every key is prefetched
+// before the others are compared, so the cache misses of the group overlap
+namespace batch_search {
+
+    constexpr int lanes = 16;
+    constexpr std::uint32_t none = UINT32_MAX;
+
+    enum class isa_t : int { scalar, avx2 };
+
+    inline bool supported(isa_t isa) noexcept {
+        if (isa == isa_t::scalar)
+            return true;
+#if defined(BATCH_SEARCH_X86) && defined(__GNUC__)
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        return avx2;
+#else
+        return false;
+#endif
+    }
+
+    inline void prefetch(const void* address) noexcept {
+#if defined(__GNUC__)
+        __builtin_prefetch(address);
+#endif
+    }
+
+    // path of every lane, keys of the nodes passed by its descent
+    template <typename KeyT, int MaxHeight>
+    struct lane_paths_t final {
+        std::array<std::array<KeyT, MaxHeight>, lanes> keys;
+        std::array<int, lanes> sizes;
+    };
+
+    // NodeT has key_ and children_[2], the right child is taken when key_ < query
+    template <typename CompT, typename NodeT, typename KeyT, int MaxHeight>
+    void descend_scalar(const NodeT* nodes, std::uint32_t root, const KeyT* queries, int count,
+                        lane_paths_t<KeyT, MaxHeight>& paths) {
+        std::array<std::uint32_t, lanes> current;
+        for (int i = 0; i < count; ++i) {
+            current[i] = root;
+            paths.sizes[i] = 0;
+        }
+
+        unsigned active = (root == none) ? 0 : (1u << count) - 1;
+        while (active) {
+            for (unsigned left = active; left; left &= left - 1) {
+                int i = std::countr_zero(left);
+                const NodeT& node = nodes[current[i]];
+                bool to_right = CompT()(node.key_, queries[i]);
+                if (!to_right && !CompT()(queries[i], node.key_)) {
+                    active &= ~(1u << i);
+                    continue;
+                }
+
+                paths.keys[i][paths.sizes[i]++] = node.key_;
+                std::uint32_t next = node.children_[to_right];
+                current[i] = next;
+                if (next == none)
+                    active &= ~(1u << i);
+                else
+                    prefetch(nodes + next);
+            }
+        }
+    }
+
+#if defined(BATCH_SEARCH_X86) && defined(__GNUC__)
+    // int keys with std::less, nodes are (key, left, right) triples of 32 bits;
+    // two vectors of 8 lanes gather their keys and compare them at once.
+    // It is not the default: the gather waits for the slowest lane, and on the
+    // machines we measured the scalar loop, which moves every lane as soon as
+    // its node arrives, was faster
+    template <int MaxHeight>
+    __attribute__((target("avx2")))
+    void descend_avx2(const std::int32_t* nodes, std::uint32_t root, const int* queries, int count,
+                      lane_paths_t<int, MaxHeight>& paths) {
+        constexpr int width = 8;
+
+        alignas(32) std::int32_t padded[lanes] = {};
+        std::memcpy(padded, queries, count * sizeof(int));
+        paths.sizes.fill(0);
+
+        const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+
+        __m256i query[2] = {_mm256_load_si256(reinterpret_cast<const __m256i*>(padded)),
+                            _mm256_load_si256(reinterpret_cast<const __m256i*>(padded + width))};
+        __m256i current[2] = {_mm256_set1_epi32(root), _mm256_set1_epi32(root)};
+
+        unsigned active = (root == none) ? 0 : (1u << count) - 1;
+        while (active) {
+            for (int v = 0; v < 2; ++v) {
+                unsigned bits = (active >> (v * width)) & 0xff;
+                if (!bits)
+                    continue;
+
+                __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), lane_bits), lane_bits);
+                __m256i base = _mm256_add_epi32(_mm256_add_epi32(current[v], current[v]), current[v]);
+                __m256i key  = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), nodes, base, mask, 4);
+
+                __m256i to_right = _mm256_cmpgt_epi32(query[v], key);
+                __m256i to_left  = _mm256_cmpgt_epi32(key, query[v]);
+                __m256i passed   = _mm256_and_si256(mask, _mm256_or_si256(to_left, to_right));
+
+                // the children are read one by one: only passed lanes need them, and
+                // a second gather would wait for the same lines the first one did
+                alignas(32) std::int32_t keys[width];
+                alignas(32) std::uint32_t children[width];
+                _mm256_store_si256(reinterpret_cast<__m256i*>(keys), key);
+                _mm256_store_si256(reinterpret_cast<__m256i*>(children), current[v]);
+
+                unsigned right_bits  = _mm256_movemask_ps(_mm256_castsi256_ps(to_right));
+                unsigned passed_bits = _mm256_movemask_ps(_mm256_castsi256_ps(passed));
+                unsigned live_bits   = 0;
+                for (unsigned left = passed_bits; left; left &= left - 1) {
+                    int i = std::countr_zero(left);
+                    int lane = v * width + i;
+                    paths.keys[lane][paths.sizes[lane]++] = keys[i];
+
+                    std::uint32_t child = nodes[3 * std::size_t{children[i]} + 1 + ((right_bits >> i) & 1)];
+                    children[i] = child;
+                    if (child != none) {
+                        live_bits |= 1u << i;
+                        prefetch(nodes + 3 * std::size_t{child});
+                    }
+                }
+                current[v] = _mm256_load_si256(reinterpret_cast<const __m256i*>(children));
+
+                active = (active & ~(0xffu << (v * width))) | (live_bits << (v * width));
+            }
+        }
+    }
+#endif
+}
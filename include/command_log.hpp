@@ -0,0 +1,243 @@
+#pragma once
+
+#include "fast_io.hpp"
+#include <concepts>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+namespace command_log {
+
+    // one byte per command, queries on the detached tree have detached_flag set
+    enum class opcode_t : std::uint8_t {
+        insert, detach_insert, reset, kth, rank, lower_bound, upper_bound, count_in_range
+    };
+    constexpr std::uint8_t detached_flag = 0x80;
+
+    // header of a binary log, followed by the commands up to the end of the file
+    constexpr std::string_view magic{"PTLOG001"};
+
+    template <std::integral KeyT>
+    struct command_t final {
+        opcode_t opcode   = opcode_t::reset;
+        bool     detached = false;
+        KeyT     key      = 0;
+        KeyT     last_key = 0; // second key of count_in_range
+    };
+
+    // message is the one the driver prints
+    class parse_error final : public std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    inline bool is_query(char command) {
+        return (command == 'o' || command == 'n' || command == 'l' ||
+                command == 'u' || command == 'c');
+    }
+
+    // text grammar: "k key", "s k key", "s <query>", "r" or "<query>",
+    // where query is "o i", "n key", "l key", "u key" or "c first last"
+    class text_reader_t final {
+        fast_io::input_t& input_;
+
+    private:
+        template <std::integral KeyT>
+        void read_key(KeyT& key) {
+            if (!input_.read(key))
+                throw parse_error("Error input, need key as int\n");
+        }
+
+        template <std::integral KeyT>
+        void read_query(char query, command_t<KeyT>& command) {
+            switch (query) {
+                case 'o': command.opcode = opcode_t::kth;            break;
+                case 'n': command.opcode = opcode_t::rank;           break;
+                case 'l': command.opcode = opcode_t::lower_bound;    break;
+                case 'u': command.opcode = opcode_t::upper_bound;    break;
+                case 'c': command.opcode = opcode_t::count_in_range; break;
+            }
+
+            read_key(command.key);
+            if (command.opcode == opcode_t::count_in_range)
+                read_key(command.last_key);
+        }
+
+    public:
+        explicit text_reader_t(fast_io::input_t& input) : input_(input) {}
+
+        // false at the end of input, throws parse_error on a wrong command
+        template <std::integral KeyT>
+        bool read(command_t<KeyT>& command) {
+            char name;
+            if (!input_.read(name))
+                return false;
+
+            command.detached = false;
+            switch (name) {
+                case 'k':
+                    command.opcode = opcode_t::insert;
+                    read_key(command.key);
+                    return true;
+
+                case 's':
+                    if (!input_.read(name) || (name != 'k' && !is_query(name)))
+                        throw parse_error("Error input, need detach command == \'k\' or query\n");
+
+                    if (name == 'k') {
+                        command.opcode = opcode_t::detach_insert;
+                        read_key(command.key);
+                        return true;
+                    }
+
+                    command.detached = true;
+                    read_query(name, command);
+                    return true;
+
+                case 'r':
+                    command.opcode = opcode_t::reset;
+                    return true;
+
+                default:
+                    if (!is_query(name))
+                        throw parse_error("Error input, need command: \"k\", \"s\", \"r\" or query\n");
+
+                    read_query(name, command);
+                    return true;
+            }
+        }
+    };
+
+    // keys are zigzag varints of the difference with the previous key,
+    // so sorted or clustered keys take one or two bytes; the index of "o"
+    // is not a key and is stored as a plain zigzag varint; OutputT takes
+    // chars and string_views by operator<<, as fast_io::output_t does
+    template <typename OutputT = fast_io::output_t>
+    class log_writer_t final {
+        OutputT& output_;
+        std::uint64_t previous_ = 0;
+
+    private:
+        static std::uint64_t zigzag(std::int64_t value) noexcept {
+            return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+        }
+
+        void write_varint(std::uint64_t value) {
+            char bytes[10];
+            std::size_t size = 0;
+            for (; value >= 0x80; value >>= 7)
+                bytes[size++] = static_cast<char>(value | 0x80);
+            bytes[size++] = static_cast<char>(value);
+            output_ << std::string_view{bytes, size};
+        }
+
+        template <std::integral KeyT>
+        void write_key(KeyT key) {
+            std::uint64_t current = static_cast<std::uint64_t>(static_cast<std::int64_t>(key));
+            write_varint(zigzag(static_cast<std::int64_t>(current - previous_)));
+            previous_ = current;
+        }
+
+    public:
+        explicit log_writer_t(OutputT& output) : output_(output) {
+            output_ << magic;
+        }
+
+        template <std::integral KeyT>
+        void write(const command_t<KeyT>& command) {
+            auto opcode = static_cast<std::uint8_t>(command.opcode);
+            output_ << static_cast<char>(command.detached ? (opcode | detached_flag) : opcode);
+
+            switch (command.opcode) {
+                case opcode_t::reset:
+                    break;
+
+                case opcode_t::kth:
+                    write_varint(zigzag(static_cast<std::int64_t>(command.key)));
+                    break;
+
+                case opcode_t::count_in_range:
+                    write_key(command.key);
+                    write_key(command.last_key);
+                    break;
+
+                default:
+                    write_key(command.key);
+                    break;
+            }
+        }
+    };
+
+    // decodes a log written by log_writer_t straight from memory
+    class log_reader_t final {
+        const std::uint8_t* current_;
+        const std::uint8_t* end_;
+        std::uint64_t previous_ = 0;
+
+    private:
+        static std::int64_t unzigzag(std::uint64_t value) noexcept {
+            return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+        }
+
+        std::uint64_t read_varint() {
+            std::uint64_t value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                if (current_ == end_)
+                    break;
+
+                std::uint8_t byte = *current_++;
+                value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                if (!(byte & 0x80))
+                    return value;
+            }
+            throw parse_error("Error input, truncated command log\n");
+        }
+
+        template <std::integral KeyT>
+        void read_key(KeyT& key) {
+            previous_ += static_cast<std::uint64_t>(unzigzag(read_varint()));
+            key = static_cast<KeyT>(previous_);
+        }
+
+    public:
+        log_reader_t(const char* data, std::size_t size) :
+            current_(reinterpret_cast<const std::uint8_t*>(data)),
+            end_(current_ + size) {
+            if (size < magic.size() || std::string_view{data, magic.size()} != magic)
+                throw parse_error("Error input, not a command log\n");
+            current_ += magic.size();
+        }
+
+        // false at the end of the log, throws parse_error on a broken one
+        template <std::integral KeyT>
+        bool read(command_t<KeyT>& command) {
+            if (current_ == end_)
+                return false;
+
+            std::uint8_t byte = *current_++;
+            command.detached  = (byte & detached_flag);
+            byte &= ~detached_flag;
+            if (byte > static_cast<std::uint8_t>(opcode_t::count_in_range))
+                throw parse_error("Error input, unknown command in log\n");
+
+            command.opcode = static_cast<opcode_t>(byte);
+            switch (command.opcode) {
+                case opcode_t::reset:
+                    break;
+
+                case opcode_t::kth:
+                    command.key = static_cast<KeyT>(unzigzag(read_varint()));
+                    break;
+
+                case opcode_t::count_in_range:
+                    read_key(command.key);
+                    read_key(command.last_key);
+                    break;
+
+                default:
+                    read_key(command.key);
+                    break;
+            }
+            return true;
+        }
+    };
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "avl_tree.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace concurrent_tree {
+    using namespace avl_tree;
+
+    // One writer thread inserts, any number of reader threads (up to max_readers
+    // at a time) read snapshots without locks. Every insertion copies its path,
+    // so a published root and everything under it never change again; the new
+    // root is published with an atomic store.
+    //
+    // Copied nodes pile up in the buffer, so from time to time the writer moves
+    // the live tree into a new buffer and retires the old one. Readers announce
+    // the epoch they started in, and a retired buffer is freed once every reader
+    // has started after it was retired (epoch-based reclamation).
+    template <typename KeyT, typename CompT = std::less<KeyT>>
+    class concurrent_tree_t final : private avl_tree_t<KeyT, CompT> {
+        using tree_node           = typename avl_tree_t<KeyT, CompT>::tree_node;
+        using tree_nodes_buffer_t = typename avl_tree_t<KeyT, CompT>::tree_nodes_buffer_t;
+
+        using avl_tree_t<KeyT, CompT>::buffer_;
+        using avl_tree_t<KeyT, CompT>::root_;
+        using avl_tree_t<KeyT, CompT>::generation;
+        using avl_tree_t<KeyT, CompT>::freeze;
+        using avl_tree_t<KeyT, CompT>::insert_node;
+        using avl_tree_t<KeyT, CompT>::clone_subtree;
+
+    public:
+        using tree_view = typename avl_tree_t<KeyT, CompT>::tree_view;
+        using avl_tree_t<KeyT, CompT>::size;
+
+        static constexpr std::size_t max_readers = 64;
+
+    private:
+        static constexpr std::uint64_t idle = 0;
+
+        // a slot per cache line, readers do not share lines with each other
+        struct alignas(64) reader_slot_t final {
+            std::atomic<std::uint64_t> epoch{idle};
+            std::atomic<bool> taken{false};
+        };
+
+        struct retired_buffer_t final {
+            std::uint64_t epoch;
+            tree_nodes_buffer_t buffer;
+        };
+
+        std::atomic<const tree_node*> published_{nullptr};
+        std::atomic<std::uint64_t> epoch_{1};
+        std::array<reader_slot_t, max_readers> slots_;
+        std::vector<retired_buffer_t> retired_;
+
+    private:
+        void publish() noexcept { published_.store(root_); }
+
+        // moves the live tree into a new buffer, the old one stays readable
+        // until no reader can hold a root from it
+        void compact() {
+            tree_nodes_buffer_t buffer;
+            root_ = clone_subtree(buffer, root_, generation());
+            std::swap(buffer, buffer_);
+            publish();
+
+            // every reader that announces a later epoch loads the root after
+            // the store above, so it can not reach the old buffer
+            retired_.push_back({epoch_.fetch_add(1), std::move(buffer)});
+            reclaim();
+        }
+
+    public:
+        class snapshot_t;
+
+        // read access of one thread, holds a slot until destroyed
+        class reader_t final {
+            concurrent_tree_t* tree_;
+            reader_slot_t* slot_ = nullptr;
+
+        public:
+            reader_t(concurrent_tree_t& tree) : tree_(std::addressof(tree)) {
+                for (auto& slot : tree.slots_) {
+                    if (!slot.taken.exchange(true, std::memory_order_acquire)) {
+                        slot_ = std::addressof(slot);
+                        return;
+                    }
+                }
+                throw std::runtime_error("concurrent_tree_t: too many readers");
+            }
+
+            reader_t(const reader_t& other) = delete;
+            reader_t& operator=(const reader_t& other) = delete;
+
+            friend class snapshot_t;
+
+            ~reader_t() { slot_->taken.store(false, std::memory_order_release); }
+        };
+
+        // immutable tree as it was when the snapshot was taken; a reader takes
+        // one snapshot at a time and should not keep it for long, because every
+        // buffer retired meanwhile waits for it
+        class snapshot_t final {
+            reader_slot_t* slot_;
+            const tree_node* root_;
+
+        public:
+            snapshot_t(reader_t& reader) : slot_(reader.slot_) {
+                slot_->epoch.store(reader.tree_->epoch_.load());
+                root_ = reader.tree_->published_.load();
+            }
+
+            snapshot_t(const snapshot_t& other) = delete;
+            snapshot_t& operator=(const snapshot_t& other) = delete;
+
+            tree_view view() const noexcept { return tree_view{root_}; }
+
+            ~snapshot_t() { slot_->epoch.store(idle, std::memory_order_release); }
+        };
+
+    public:
+        concurrent_tree_t() {}
+
+        concurrent_tree_t(const concurrent_tree_t& other) = delete;
+        concurrent_tree_t& operator=(const concurrent_tree_t& other) = delete;
+
+        // writer only
+        void insert(const KeyT& key) {
+            freeze();
+            insert_node(root_, key);
+            publish();
+
+            if (buffer_.size() > 4 * size() + 4096)
+                compact();
+        }
+
+        // writer only: frees retired buffers no reader can see, returns how many stay
+        std::size_t reclaim() {
+            std::uint64_t oldest = UINT64_MAX;
+            for (auto& slot : slots_) {
+                std::uint64_t epoch = slot.epoch.load();
+                if (epoch != idle)
+                    oldest = std::min(oldest, epoch);
+            }
+
+            std::erase_if(retired_, [oldest](const retired_buffer_t& retired) {
+                return retired.epoch < oldest;
+            });
+            return retired_.size();
+        }
+
+        // writer only
+        std::size_t stored_nodes() const noexcept { return buffer_.size(); }
+    };
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <charconv>
+#include <concepts>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fast_io {
+
+    // read only mapping of a whole regular file, advice is passed to madvise:
+    // logs are read front to back, trees are searched at random
+    class mapped_file_t final {
+        void* data_ = nullptr;
+        std::size_t size_ = 0;
+
+    public:
+        explicit mapped_file_t(const std::string& file_name, int advice = MADV_SEQUENTIAL) {
+            int fd = ::open(file_name.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::runtime_error("can't open " + file_name);
+
+            struct stat info;
+            if (::fstat(fd, &info) < 0 || !S_ISREG(info.st_mode)) {
+                ::close(fd);
+                throw std::runtime_error(file_name + " is not a regular file");
+            }
+
+            size_ = info.st_size;
+            if (size_ != 0)
+                data_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+
+            if (data_ == MAP_FAILED)
+                throw std::runtime_error("can't map " + file_name);
+            if (data_)
+                ::madvise(data_, size_, advice);
+        }
+
+        mapped_file_t(const mapped_file_t&) = delete;
+        mapped_file_t& operator=(const mapped_file_t&) = delete;
+
+        const char* data() const noexcept { return static_cast<const char*>(data_); }
+        std::size_t size() const noexcept { return size_; }
+
+        ~mapped_file_t() {
+            if (data_)
+                ::munmap(data_, size_);
+        }
+    };
+
+    // reads a memory mapped file at once or a descriptor by large blocks,
+    // numbers are parsed in place with from_chars
+    class input_t final {
+        static constexpr std::size_t block_size = 1 << 20;
+        // longest token that must not be split between two blocks
+        static constexpr std::size_t max_token = 64;
+
+        int fd_ = -1;
+        bool owns_fd_ = false;
+        bool eof_ = false;
+
+        std::unique_ptr<mapped_file_t> mapped_;
+
+        std::vector<char> block_;
+        const char* current_ = nullptr;
+        const char* end_ = nullptr;
+
+    private:
+        static bool is_space(char c) noexcept {
+            return (c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f');
+        }
+
+        // moves the unread tail to the front of the block and reads after it
+        bool refill() {
+            if (eof_)
+                return false;
+
+            std::size_t tail = end_ - current_;
+            std::copy(current_, end_, block_.data());
+            std::size_t filled = tail;
+            while (filled < block_.size()) {
+                ssize_t count = ::read(fd_, block_.data() + filled, block_.size() - filled);
+                if (count < 0)
+                    throw std::runtime_error("read failed");
+                if (count == 0) {
+                    eof_ = true;
+                    break;
+                }
+                filled += count;
+            }
+
+            current_ = block_.data();
+            end_     = current_ + filled;
+            return (filled > tail);
+        }
+
+        bool skip_spaces() {
+            while (true) {
+                while (current_ != end_ && is_space(*current_))
+                    ++current_;
+                if (current_ != end_)
+                    return true;
+                if (!refill())
+                    return false;
+            }
+        }
+
+    public:
+        explicit input_t(int fd = STDIN_FILENO) : fd_(fd), block_(block_size) {
+            current_ = end_ = block_.data();
+        }
+
+        explicit input_t(const std::string& file_name) {
+            struct stat info;
+            if (::stat(file_name.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+                eof_     = true;
+                mapped_  = std::make_unique<mapped_file_t>(file_name);
+                current_ = mapped_->data();
+                end_     = current_ + mapped_->size();
+                return;
+            }
+
+            // not a regular file (pipe, tty): read it by blocks
+            fd_ = ::open(file_name.c_str(), O_RDONLY);
+            if (fd_ < 0)
+                throw std::runtime_error("can't open " + file_name);
+            owns_fd_ = true;
+
+            block_.resize(block_size);
+            current_ = end_ = block_.data();
+        }
+
+        input_t(const input_t&) = delete;
+        input_t& operator=(const input_t&) = delete;
+
+        // same as istream >> char: skips spaces, false at the end of input
+        bool read(char& c) {
+            if (!skip_spaces())
+                return false;
+
+            c = *current_++;
+            return true;
+        }
+
+        // same as istream >> int: skips spaces, accepts a leading '+',
+        // false on the end of input, a non number or an overflow
+        template <std::integral T>
+        bool read(T& value) {
+            if (!skip_spaces())
+                return false;
+
+            if (static_cast<std::size_t>(end_ - current_) < max_token)
+                refill();
+
+            const char* first = current_;
+            if (*first == '+' && first + 1 != end_ && first[1] != '-')
+                ++first;
+
+            auto [last, error] = std::from_chars(first, end_, value);
+            if (error != std::errc{})
+                return false;
+
+            current_ = last;
+            return true;
+        }
+
+        ~input_t() {
+            if (owns_fd_)
+                ::close(fd_);
+        }
+    };
+
+    // collects output in a block and writes it by one fwrite, so it keeps
+    // its order with std::cout as long as cout is synced with stdio
+    class output_t final {
+        static constexpr std::size_t block_size = 1 << 16;
+        // enough for any integer
+        static constexpr std::size_t max_token = 64;
+
+        std::FILE* file_;
+        std::vector<char> block_;
+        std::size_t size_ = 0;
+
+    private:
+        void reserve(std::size_t count) {
+            if (size_ + count > block_.size())
+                flush();
+        }
+
+    public:
+        explicit output_t(std::FILE* file = stdout) : file_(file), block_(block_size) {}
+
+        output_t(const output_t&) = delete;
+        output_t& operator=(const output_t&) = delete;
+
+        output_t& operator<<(char c) {
+            reserve(1);
+            block_[size_++] = c;
+            return *this;
+        }
+
+        output_t& operator<<(std::string_view str) {
+            if (str.size() > block_.size()) {
+                flush();
+                std::fwrite(str.data(), 1, str.size(), file_);
+                return *this;
+            }
+
+            reserve(str.size());
+            std::copy(str.begin(), str.end(), block_.data() + size_);
+            size_ += str.size();
+            return *this;
+        }
+
+        template <std::integral T>
+        output_t& operator<<(T value) {
+            reserve(max_token);
+            char* last = std::to_chars(block_.data() + size_, block_.data() + block_.size(), value).ptr;
+            size_ = last - block_.data();
+            return *this;
+        }
+
+        void flush() {
+            if (size_ != 0)
+                std::fwrite(block_.data(), 1, size_, file_);
+            size_ = 0;
+            std::fflush(file_);
+        }
+
+        ~output_t() { flush(); }
+    };
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <iostream>
+
+namespace latency {
+
+    // log-linear histogram of durations in ns: exact below 16 ns, then 8 buckets
+    // per power of two, so a percentile is off by at most 12.5%
+    class histogram_t final {
+        static constexpr int sub_buckets   = 8;
+        static constexpr int linear_limit  = 16;
+        static constexpr int buckets_count = linear_limit + (64 - 4) * sub_buckets;
+
+        std::array<std::uint64_t, buckets_count> counts_{};
+        std::uint64_t total_ = 0;
+        std::uint64_t max_   = 0;
+
+    private:
+        static int bucket(std::uint64_t value) noexcept {
+            if (value < linear_limit)
+                return static_cast<int>(value);
+
+            int exponent = std::bit_width(value) - 1;
+            int sub      = static_cast<int>(value >> (exponent - 3)) & (sub_buckets - 1);
+            return linear_limit + (exponent - 4) * sub_buckets + sub;
+        }
+
+        static std::uint64_t lower_bound(int index) noexcept {
+            if (index < linear_limit)
+                return index;
+
+            int exponent = (index - linear_limit) / sub_buckets + 4;
+            int sub      = (index - linear_limit) % sub_buckets;
+            return static_cast<std::uint64_t>(sub_buckets + sub) << (exponent - 3);
+        }
+
+    public:
+        void add(std::uint64_t value) noexcept {
+            ++counts_[bucket(value)];
+            ++total_;
+            max_ = std::max(max_, value);
+        }
+
+        std::uint64_t count() const noexcept { return total_; }
+        std::uint64_t max() const noexcept { return max_; }
+
+        // smallest bucket bound with at least fraction of values not above it
+        std::uint64_t percentile(double fraction) const noexcept {
+            std::uint64_t rank = static_cast<std::uint64_t>(fraction * total_);
+            std::uint64_t seen = 0;
+            for (int i = 0; i < buckets_count; ++i) {
+                seen += counts_[i];
+                if (seen > rank)
+                    return lower_bound(i);
+            }
+            return max_;
+        }
+
+        std::ostream& print(std::ostream& os) const {
+            return os << "commands=" << total_
+                      << " p50_ns="  << percentile(0.5)
+                      << " p90_ns="  << percentile(0.9)
+                      << " p99_ns="  << percentile(0.99)
+                      << " p999_ns=" << percentile(0.999)
+                      << " max_ns="  << max_ << "\n";
+        }
+    };
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+namespace parallel {
+
+    // below this many elements per thread sorting is not worth a thread
+    constexpr std::size_t min_chunk_size = 1 << 16;
+
+    inline std::size_t threads_count(std::size_t size) {
+        std::size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+        return std::max<std::size_t>(1, std::min(hardware, size / min_chunk_size));
+    }
+
+    // levels of a binary recursion to fork for it to run on about threads threads
+    inline int fork_depth(std::size_t threads) {
+        return std::bit_width(std::max<std::size_t>(threads, 1)) - 1;
+    }
+
+    // runs right on a new thread while left runs here, or both here if !fork
+    template <typename LeftT, typename RightT>
+    void invoke(bool fork, LeftT left, RightT right) {
+        if (!fork) {
+            left();
+            right();
+            return;
+        }
+
+        std::jthread thread{right};
+        left();
+    }
+
+    // sorts chunks in parallel, then merges neighbours pairwise, also in parallel
+    template <typename RandomIt, typename CompT>
+    void sort(RandomIt first, RandomIt last, CompT comp) {
+        std::size_t size  = std::distance(first, last);
+        std::size_t count = threads_count(size);
+        if (count == 1) {
+            std::sort(first, last, comp);
+            return;
+        }
+
+        std::vector<RandomIt> bounds;
+        for (std::size_t i = 0; i < count; ++i)
+            bounds.push_back(first + i * size / count);
+        bounds.push_back(last);
+
+        std::vector<std::jthread> threads;
+        for (std::size_t i = 0; i < count; ++i)
+            threads.emplace_back([&, i] { std::sort(bounds[i], bounds[i + 1], comp); });
+        threads.clear();
+
+        while (bounds.size() > 2) {
+            std::vector<RandomIt> merged;
+            for (std::size_t i = 0; i + 2 < bounds.size(); i += 2) {
+                threads.emplace_back([&, i] {
+                    std::inplace_merge(bounds[i], bounds[i + 1], bounds[i + 2], comp);
+                });
+                merged.push_back(bounds[i]);
+            }
+            if (bounds.size() % 2 == 0)
+                merged.push_back(bounds[bounds.size() - 2]);
+            merged.push_back(last);
+
+            threads.clear();
+            bounds = std::move(merged);
+        }
+    }
+}
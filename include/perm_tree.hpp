@@ -1,202 +1,314 @@
 #pragma once
 
 #include "avl_tree.hpp"
+#include <stdexcept>
+#include <tuple>
 
 namespace perm_tree {
     using namespace avl_tree;
 
-    template <typename KeyT, typename CompT = std::less<KeyT>>
-    class perm_tree_t final : public avl_tree_t<KeyT, CompT> {
-        using ascending_range   = typename avl_tree_t<KeyT, CompT>::ascending_range;
-        using internal_iterator = typename avl_tree_t<KeyT, CompT>::internal_iterator;
-        using list_nodes_t      = typename avl_tree_t<KeyT, CompT>::tree_nodes_buffer_t::list_nodes_t;
-        using tree_node         = typename avl_tree_t<KeyT, CompT>::tree_node;
+    template <typename KeyT, typename CompT = std::less<KeyT>, typename StatsT = null_stats_t>
+    class perm_tree_t final : public avl_tree_t<KeyT, CompT, StatsT> {
+        using tree_node           = typename avl_tree_t<KeyT, CompT, StatsT>::tree_node;
+        using tree_nodes_buffer_t = typename avl_tree_t<KeyT, CompT, StatsT>::tree_nodes_buffer_t;
+
+        using avl_tree_t<KeyT, CompT, StatsT>::buffer_;
+        using avl_tree_t<KeyT, CompT, StatsT>::root_;
+        using avl_tree_t<KeyT, CompT, StatsT>::generation;
+        using avl_tree_t<KeyT, CompT, StatsT>::stats_;
+        using avl_tree_t<KeyT, CompT, StatsT>::freeze;
+        using avl_tree_t<KeyT, CompT, StatsT>::insert_node;
+        using avl_tree_t<KeyT, CompT, StatsT>::erase_node;
+        using avl_tree_t<KeyT, CompT, StatsT>::clone_subtree;
+        using avl_tree_t<KeyT, CompT, StatsT>::clone_sharing;
+        using set_operation_t     = typename avl_tree_t<KeyT, CompT, StatsT>::set_operation_t;
 
-        using avl_tree_t<KeyT, CompT>::buffer_;
+    public:
+        using version_t = std::size_t;
+        using tree_view     = typename avl_tree_t<KeyT, CompT, StatsT>::tree_view;
+        using frozen_tree_t = typename avl_tree_t<KeyT, CompT, StatsT>::frozen_tree_t;
 
-        avl_tree_t<KeyT, CompT>::tree_nodes_buffer_t branch_buffer_;
+    private:
         tree_node* new_root_ = nullptr;
+        // new_root_ is null also when everything was erased from the detached tree
+        bool detached_ = false;
+        std::vector<const tree_node*> versions_;
 
     private:
-        std::list<KeyT> insert2new(const KeyT& key) {
-            std::list<KeyT> path;
-            const tree_node* main_root = avl_tree_t<KeyT, CompT>::get_root();
-            if (!main_root)
+        template <typename OutputIt>
+        OutputIt insert2new(const KeyT& key, OutputIt path) {
+            if (!root_)
                 return path;
 
-            new_root_ = branch_buffer_.add_node(main_root);
-
-            internal_iterator current     = new_root_;
-            internal_iterator destination = new_root_;
-            while (current.is_valid()) {
-                if (CompT()(key, current->key_)) {
-                    path.push_back(current->key_);
-                    if (current->left_) {
-                        current->left_ = branch_buffer_.add_node(current->left_);
-                        current = current->left_;
-                    } else {
-                        current->left_ = branch_buffer_.add_node(key);
-                        destination = current->left_;
-                        break;
-                    }
-                } else if (CompT()(current->key_, key)) {
-                    path.push_back(current->key_);
-                    if (current->right_) {
-                        current->right_ = branch_buffer_.add_node(current->right_);
-                        current = current->right_;
-                    } else {
-                        current->right_ = branch_buffer_.add_node(key);
-                        destination = current->right_;
-                        break;
-                    }
-                } else {
-                    return path;
-                }
-            }
-
-            switch2new();
-
-            avl_tree_t<KeyT, CompT>::update_height (destination);
-            avl_tree_t<KeyT, CompT>::update_Nchilds(destination);
-
-#ifdef DEBUG
-            print();
-            std::cerr << "\n";
-            branch_buffer_.print();
-#endif
-
-            for (auto& node : ascending_range{destination})
-                avl_tree_t<KeyT, CompT>::balance(node, new_root_);
+            stats_.count(event_t::detach_insert);
+            freeze();
+            new_root_ = root_;
+            detached_ = true;
+            insert_node(new_root_, key, path);
+            versions_.push_back(new_root_);
+            freeze();
 
             return path;
         }
 
-        void switch2new() {
-            list_nodes_t& nodes = branch_buffer_.get_nodes();
-            for (auto it = nodes.begin(), end = nodes.end(); it != end; ++it) {
-                tree_node* node = it->get();
-                if (node->left_)  node->left_->parent_  = node;
-                if (node->right_) node->right_->parent_ = node;
-            }
-        }
-
-        void switch2old() {
-            list_nodes_t& nodes = branch_buffer_.get_nodes();
-            for (auto it = nodes.begin(), end = nodes.end(); it != end; ++it) {
-                tree_node* node = buffer_.get_node(it->get()->key_);
-                if (!node)
-                    continue;
-
-                if (node->left_)  node->left_->parent_  = node;
-                if (node->right_) node->right_->parent_ = node;
-            }
-        }
-
     public:
         perm_tree_t() {}
 
-        perm_tree_t(const perm_tree_t<KeyT, CompT>& other) :
-            avl_tree_t<KeyT, CompT>(static_cast<const avl_tree_t<KeyT, CompT>&>(other))
-        {
-            if (!other.new_root_)
-                return;
-
-            reset();
-
-            const list_nodes_t& nodes = other.branch_buffer_.get_nodes();
-            tree_node* parent  = nullptr;
-            tree_node* current = nullptr;
-            for (auto it = nodes.begin(), end = nodes.end(); it != end; ++it) {
-                current = branch_buffer_.add_node(it->get());
-                tree_node* node = buffer_.get_node(it->get()->key_);
+        template <std::input_iterator InputIt>
+        perm_tree_t(InputIt first, InputIt last) : avl_tree_t<KeyT, CompT, StatsT>(first, last) {}
 
-                current->parent_ = parent;
-                parent = current;
-
-                if (!node)
-                    continue;
-
-                current->left_  = node->left_;
-                current->right_ = node->right_;
-            }
-            new_root_ = branch_buffer_.front_ptr();
-            branch_buffer_.print();
+        // the main and the detached trees of frozen() sharing nodes as they did;
+        // the versions are not frozen, so there are none
+        explicit perm_tree_t(const frozen_tree_t& frozen) {
+            std::tie(root_, new_root_) = this->thaw(frozen, true);
+            detached_ = frozen.has_detached();
+            if (detached_)
+                freeze();
         }
 
-        perm_tree_t<KeyT, CompT>& operator=(const perm_tree_t<KeyT, CompT>& other) {
+        // shares every node with other, the versions included
+        perm_tree_t(const perm_tree_t<KeyT, CompT, StatsT>& other) : avl_tree_t<KeyT, CompT, StatsT>(other),
+                                                                      new_root_(other.new_root_),
+                                                                      detached_(other.detached_),
+                                                                      versions_(other.versions_) {}
+
+        perm_tree_t<KeyT, CompT, StatsT>& operator=(const perm_tree_t<KeyT, CompT, StatsT>& other) {
             if (this == &other)
                 return *this;
 
-            perm_tree_t<KeyT, CompT> new_tree{other};
-            avl_tree_t<KeyT, CompT>::operator=(static_cast<const avl_tree_t<KeyT, CompT>&>(other));
-            branch_buffer_ = std::move(new_tree.branch_buffer_);
-            new_root_      = std::move(new_tree.new_root_);
+            perm_tree_t<KeyT, CompT, StatsT> new_tree{other};
+            *this = std::move(new_tree);
             return *this;
         }
 
-        perm_tree_t(perm_tree_t<KeyT, CompT>&& other) noexcept :
-            avl_tree_t<KeyT, CompT>(std::move(static_cast<avl_tree_t<KeyT, CompT>&>(other))),
-            branch_buffer_(std::move(other.branch_buffer_)),
-            new_root_     (std::move(other.new_root_)) {
-            other.new_root_ = nullptr;
-        }
-        
-        perm_tree_t& operator=(perm_tree_t<KeyT, CompT>&& other) noexcept {
+        perm_tree_t(perm_tree_t<KeyT, CompT, StatsT>&& other) noexcept :
+            avl_tree_t<KeyT, CompT, StatsT>(std::move(static_cast<avl_tree_t<KeyT, CompT, StatsT>&>(other))),
+            new_root_(std::exchange(other.new_root_, nullptr)),
+            detached_(std::exchange(other.detached_, false)),
+            versions_(std::move(other.versions_)) {}
+
+        perm_tree_t& operator=(perm_tree_t<KeyT, CompT, StatsT>&& other) noexcept {
             if (this == &other)
                 return *this;
 
-            avl_tree_t<KeyT, CompT>::operator=(std::move(static_cast<avl_tree_t<KeyT, CompT>&>(other)));
-            std::swap(branch_buffer_, other.branch_buffer_);
-            std::swap(new_root_,      other.new_root_);
+            avl_tree_t<KeyT, CompT, StatsT>::operator=(std::move(static_cast<avl_tree_t<KeyT, CompT, StatsT>&>(other)));
+            std::swap(new_root_, other.new_root_);
+            std::swap(detached_, other.detached_);
+            std::swap(versions_, other.versions_);
             return *this;
         }
-        
+
         std::ostream& print(std::ostream& os = std::cerr) const {
-            switch2old();
-            avl_tree_t<KeyT, CompT>::print(os);
+            avl_tree_t<KeyT, CompT, StatsT>::print(os);
 
             if (!new_root_)
                 return os;
 
-            switch2new();
             os << "\n\n";
             os << print_lblue("Detached tree with root = " << new_root_->key_ <<
                               "(" << new_root_ << ")" <<
-                              ":\nkey(<child>, <child>, <parent>, <Nleft>, <Nright>,"
-                                     "<height>, <ptr>, <parent ptr>):\n");
+                              ":\nkey(<child>, <child>, <size>, <height>, <ptr>):\n");
 
-            avl_tree_t<KeyT, CompT>::print_subtree(os, new_root_);
+            avl_tree_t<KeyT, CompT, StatsT>::print_subtree(os, new_root_);
             return os;
         }
 
-        avl_tree_t<KeyT, CompT>::external_iterator insert(const KeyT& key) {
+        avl_tree_t<KeyT, CompT, StatsT>::external_iterator insert(const KeyT& key) {
+            attach();
+            tree_node* node = insert_node(root_, key);
+            return {root_, node};
+        }
+
+        avl_tree_t<KeyT, CompT, StatsT>::external_iterator insert(KeyT&& key) {
+            attach();
+            tree_node* node = insert_node(root_, std::move(key));
+            return {root_, node};
+        }
+
+        template <typename... Args>
+        avl_tree_t<KeyT, CompT, StatsT>::external_iterator emplace(Args&&... args) {
+            attach();
+            tree_node* node = insert_node(root_, KeyT(std::forward<Args>(args)...));
+            return {root_, node};
+        }
+
+        bool erase(const KeyT& key) {
             attach();
-            return avl_tree_t<KeyT, CompT>::insert(key);
+            return erase_node(root_, key);
+        }
+
+        // drops the detached tree and all versions
+        template <std::forward_iterator ForwardIt>
+        void build_from_sorted(ForwardIt first, ForwardIt last) {
+            avl_tree_t<KeyT, CompT, StatsT>::build_from_sorted(first, last);
+            new_root_ = nullptr;
+            detached_ = false;
+            versions_.clear();
         }
 
         std::list<KeyT> detach_insert(const KeyT& key) {
+            std::list<KeyT> path;
+            detach_insert(key, std::back_inserter(path));
+            return path;
+        }
+
+        // writes the path to out instead of allocating a list, e.g. into
+        // a reused container or an insert_path_t
+        template <std::output_iterator<const KeyT&> OutputIt>
+        OutputIt detach_insert(const KeyT& key, OutputIt out) {
             attach();
-            return insert2new(key);
+            return insert2new(key, out);
         }
 
-        void attach() {
-            if (!new_root_)
+        // erases key from a detached copy of the main tree, which is kept as a new
+        // version even if there is no such key; writes the keys passed before
+        // reaching it to out, as detach_insert does
+        template <std::output_iterator<const KeyT&> OutputIt>
+        OutputIt detach_erase(const KeyT& key, OutputIt out) {
+            attach();
+            if (!root_)
+                return out;
+
+            freeze();
+            new_root_ = root_;
+            detached_ = true;
+            erase_node(new_root_, key, out);
+            versions_.push_back(new_root_);
+            freeze();
+
+            return out;
+        }
+
+        std::list<KeyT> detach_erase(const KeyT& key) {
+            std::list<KeyT> path;
+            detach_erase(key, std::back_inserter(path));
+            return path;
+        }
+
+        // inserts all keys into one detached tree, so every shared node is copied
+        // at most once; i-th path is the one of i-th key after the previous ones
+        template <std::input_iterator InputIt>
+        insert_paths_t<KeyT> detach_insert(InputIt first, InputIt last) {
+            attach();
+
+            insert_paths_t<KeyT> paths;
+            if constexpr (std::forward_iterator<InputIt>) {
+                std::size_t count = std::distance(first, last);
+                paths.reserve(count, count * (root_ ? root_->height_ : 0));
+            }
+
+            if (!root_) {
+                for (; first != last; ++first)
+                    paths.end_path();
+                return paths;
+            }
+
+            freeze();
+            new_root_ = root_;
+            detached_ = true;
+            auto out  = std::back_inserter(paths);
+            for (; first != last; ++first) {
+                stats_.count(event_t::detach_insert);
+                insert_node(new_root_, *first, out);
+                paths.end_path();
+            }
+            versions_.push_back(new_root_);
+            freeze();
+
+            return paths;
+        }
+
+        // set operations, join and split change the main tree, with the detached one attached first
+        void unite(const avl_tree_t<KeyT, CompT, StatsT>& other, std::size_t threads = 0) {
+            attach();
+            avl_tree_t<KeyT, CompT, StatsT>::unite(other, threads);
+        }
+
+        void subtract(const avl_tree_t<KeyT, CompT, StatsT>& other, std::size_t threads = 0) {
+            attach();
+            avl_tree_t<KeyT, CompT, StatsT>::subtract(other, threads);
+        }
+
+        void intersect(const avl_tree_t<KeyT, CompT, StatsT>& other, std::size_t threads = 0) {
+            attach();
+            avl_tree_t<KeyT, CompT, StatsT>::intersect(other, threads);
+        }
+
+        void join(const avl_tree_t<KeyT, CompT, StatsT>& greater) {
+            attach();
+            avl_tree_t<KeyT, CompT, StatsT>::join(greater);
+        }
+
+        avl_tree_t<KeyT, CompT, StatsT> split(const KeyT& key) {
+            attach();
+            return avl_tree_t<KeyT, CompT, StatsT>::split(key);
+        }
+
+        // detached tree of the main one and all keys of other, kept as a new version;
+        // commits a branch of many keys without inserting them one by one
+        void detach_unite(const avl_tree_t<KeyT, CompT, StatsT>& other, std::size_t threads = 0) {
+            attach();
+
+            freeze();
+            new_root_ = root_;
+            detached_ = true;
+            this->template combine<set_operation_t::unite>(new_root_, other, threads);
+            versions_.push_back(new_root_);
+            freeze();
+        }
+
+        void attach() noexcept {
+            if (!detached_)
                 return;
 
-            switch2old();
-            avl_tree_t<KeyT, CompT>::insert(branch_buffer_.back_node().key_);
-            reset();
+            root_ = std::exchange(new_root_, nullptr);
+            detached_ = false;
         }
 
-        void reset() {
-            switch2old();
-            branch_buffer_.clear();
+        void reset() noexcept {
             new_root_ = nullptr;
+            detached_ = false;
+        }
+
+        tree_view detached() const noexcept { return tree_view{new_root_}; }
+
+        // van Emde Boas copy of the main and the detached trees, see frozen_tree_t
+        frozen_tree_t frozen() const { return frozen_tree_t{root_, new_root_, detached_}; }
+
+        std::size_t versions_count() const noexcept { return versions_.size(); }
+
+        version_t last_version() const {
+            if (versions_.empty())
+                throw std::out_of_range("no versions");
+            return versions_.size() - 1;
         }
+
+        tree_view version(version_t version) const {
+            if (version >= versions_.size())
+                throw std::out_of_range("unknown version");
+            return tree_view{versions_[version]};
+        }
+
+        // drops all version handles and compacts the buffer down to
+        // the nodes of the main and the detached trees
+        void release_versions() {
+            stats_.count(event_t::compaction);
+            tree_nodes_buffer_t buffer;
+            tree_node* root = clone_subtree(buffer, root_, generation());
+            new_root_ = clone_sharing(buffer, new_root_, generation(), root_, root);
+            root_     = root;
+            buffer_   = std::move(buffer);
+            versions_.clear();
+
+            if (detached_)
+                freeze();
+        }
+
+        std::size_t stored_nodes() const noexcept { return buffer_.size(); }
     };
 
-    template <typename KeyT, typename CompT>
-    std::ostream& operator<<(std::ostream& os, const perm_tree_t<KeyT, CompT>& perm_tree) {
+    template <typename KeyT, typename CompT, typename StatsT>
+    std::ostream& operator<<(std::ostream& os, const perm_tree_t<KeyT, CompT, StatsT>& perm_tree) {
         return perm_tree.print(os);
     }
-}
\ No newline at end of file
+}
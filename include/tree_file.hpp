@@ -0,0 +1,137 @@
+#pragma once
+
+#include "avl_tree.hpp"
+#include "fast_io.hpp"
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// a frozen_tree_t in a file: a header of header_size bytes followed by the
+// nodes as they are in memory, children are indices into them. A mapped file
+// is a frozen_tree_t without reading or copying anything, and a tree is
+// restored from it in one pass (avl_tree_t and perm_tree_t take frozen trees)
+namespace tree_file {
+
+    constexpr std::string_view magic{"PTTREE01"};
+    constexpr std::size_t header_size = 64;
+    // written as is, so a file of a machine with the other byte order differs
+    constexpr std::uint32_t byte_order = 0x01020304;
+
+    struct header_t final {
+        char          magic[8];
+        std::uint32_t key_size;
+        std::uint32_t node_size;
+        std::uint64_t node_count;
+        std::uint32_t root;
+        std::int32_t  height;
+        std::uint64_t size;
+        std::uint32_t detached_root;
+        std::int32_t  detached_height;
+        std::uint64_t detached_size;
+        std::uint32_t has_detached;
+        std::uint32_t byte_order;
+    };
+    static_assert(sizeof(header_t) == header_size);
+
+    // FrozenT is a frozen_tree_t, e.g. of avl_tree_t::frozen() or perm_tree_t::frozen();
+    // the file is written next to file_name, synced and renamed, so it is never seen half written
+    template <typename FrozenT>
+    void save(const std::string& file_name, const FrozenT& frozen) {
+        static_assert(std::is_trivially_copyable_v<typename FrozenT::key_type>, "tree_file: keys are stored as bytes");
+
+        auto root     = frozen.root();
+        auto detached = frozen.detached_root();
+        auto nodes    = frozen.bytes();
+
+        header_t header{};
+        std::memcpy(header.magic, magic.data(), magic.size());
+        header.key_size        = sizeof(typename FrozenT::key_type);
+        header.node_size       = FrozenT::node_size;
+        header.node_count      = nodes.size() / FrozenT::node_size;
+        header.root            = root.index;
+        header.height          = root.height;
+        header.size            = root.size;
+        header.detached_root   = detached.index;
+        header.detached_height = detached.height;
+        header.detached_size   = detached.size;
+        header.has_detached    = frozen.has_detached();
+        header.byte_order      = byte_order;
+
+        std::string temp_name = file_name + ".tmp";
+        {
+            std::ofstream file{temp_name, std::ios::binary | std::ios::trunc};
+            if (!file)
+                throw std::runtime_error("can't open " + temp_name);
+
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(nodes.data()), nodes.size());
+            if (!file.flush())
+                throw std::runtime_error("can't write " + temp_name);
+        }
+
+        // the data must be on disk before the name is, or a crash may leave an empty file under it
+        int fd = ::open(temp_name.c_str(), O_RDONLY);
+        if (fd < 0 || ::fsync(fd) < 0) {
+            if (fd >= 0)
+                ::close(fd);
+            throw std::runtime_error("can't write " + temp_name);
+        }
+        ::close(fd);
+        std::filesystem::rename(temp_name, file_name);
+    }
+
+    // file of save() mapped read only, TreeT is the avl_tree_t or perm_tree_t it was
+    // saved from; the header is checked, and the shape of the trees in one pass over
+    // the nodes, which reads the whole file. advice goes to madvise, MADV_RANDOM
+    // suits queries on a cold file and MADV_SEQUENTIAL restoring the whole tree
+    template <typename TreeT>
+    class mapped_tree_t final {
+    public:
+        using frozen_tree_t = typename TreeT::frozen_tree_t;
+
+    private:
+        fast_io::mapped_file_t file_;
+        frozen_tree_t tree_;
+
+    public:
+        explicit mapped_tree_t(const std::string& file_name, int advice = MADV_NORMAL) : file_(file_name, advice) {
+            header_t header;
+            if (file_.size() < header_size)
+                throw std::runtime_error(file_name + " is not a tree file");
+            std::memcpy(&header, file_.data(), sizeof(header));
+
+            if (std::string_view{header.magic, sizeof(header.magic)} != magic)
+                throw std::runtime_error(file_name + " is not a tree file");
+            if (header.byte_order != byte_order || header.key_size != sizeof(typename frozen_tree_t::key_type) ||
+                header.node_size != frozen_tree_t::node_size)
+                throw std::runtime_error(file_name + " holds trees of other keys");
+            if (file_.size() - header_size != header.node_count * header.node_size)
+                throw std::runtime_error(file_name + " is truncated");
+
+            std::span<const std::byte> nodes{reinterpret_cast<const std::byte*>(file_.data()) + header_size,
+                                             file_.size() - header_size};
+            try {
+                tree_ = frozen_tree_t::borrow(nodes, {header.root, header.height, header.size},
+                                              {header.detached_root, header.detached_height, header.detached_size},
+                                              header.has_detached != 0);
+            } catch (const std::invalid_argument& e) {
+                throw std::runtime_error(file_name + ": " + e.what());
+            }
+        }
+
+        mapped_tree_t(const mapped_tree_t& other) = delete;
+        mapped_tree_t& operator=(const mapped_tree_t& other) = delete;
+
+        // valid as long as this object is
+        const frozen_tree_t& tree() const noexcept { return tree_; }
+    };
+}
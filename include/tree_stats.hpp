@@ -0,0 +1,114 @@
+#pragma once
+
+#include "ANSI_colors.hpp"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+namespace avl_tree {
+
+    // events on the hot paths of insertion
+    enum class event_t : int {
+        insert,          // calls of insert_node, detached ones included
+        detach_insert,   // insertions into a detached tree
+        erase,           // calls of erase_node, detached ones included
+        compare,         // comparator calls while descending
+        ancestor_update, // steps of the bottom-up pass
+        height_update,   // heights recomputed by that pass before it stops
+        rotate_left,
+        rotate_right,
+        node_alloc,      // new nodes in the buffer
+        node_copy,       // nodes copied because they were frozen
+        node_free,       // erased nodes given back to the buffer
+        compaction,      // release_versions() calls
+        count_
+    };
+
+    // where insertion time goes
+    enum class phase_t : int {
+        descent,         // search of the place for the new key
+        update,          // bottom-up pass with copies and rotations
+        count_
+    };
+
+    // default policy of avl_tree_t: every hook is empty and the timer is never read
+    struct null_stats_t final {
+        static constexpr bool enabled = false;
+
+        void count(event_t) noexcept {}
+        void add_time(phase_t, std::uint64_t) noexcept {}
+    };
+
+    // counts every event and sums time per phase, for avl_tree_t<KeyT, CompT, tree_stats_t>
+    struct tree_stats_t final {
+        static constexpr bool enabled = true;
+
+        std::array<std::uint64_t, static_cast<int>(event_t::count_)> events{};
+        std::array<std::uint64_t, static_cast<int>(phase_t::count_)> times_ns{};
+
+        void count(event_t event) noexcept { ++events[static_cast<int>(event)]; }
+
+        void add_time(phase_t phase, std::uint64_t ns) noexcept {
+            times_ns[static_cast<int>(phase)] += ns;
+        }
+
+        std::uint64_t operator[](event_t event) const noexcept { return events[static_cast<int>(event)]; }
+        std::uint64_t operator[](phase_t phase) const noexcept { return times_ns[static_cast<int>(phase)]; }
+
+        void clear() noexcept {
+            events.fill(0);
+            times_ns.fill(0);
+        }
+
+        std::ostream& print(std::ostream& os = std::cerr) const {
+            static const char* event_names[] = {
+                "insert", "detach_insert", "erase", "compare", "ancestor_update", "height_update",
+                "rotate_left", "rotate_right", "node_alloc", "node_copy", "node_free", "compaction"
+            };
+            static const char* phase_names[] = {"descent_ns", "update_ns"};
+
+            os << print_lblue("tree stats:\n");
+            for (int i = 0; i < static_cast<int>(event_t::count_); ++i)
+                os << event_names[i] << "=" << events[i] << "\n";
+            for (int i = 0; i < static_cast<int>(phase_t::count_); ++i)
+                os << phase_names[i] << "=" << times_ns[i] << "\n";
+            return os;
+        }
+    };
+
+    inline std::ostream& operator<<(std::ostream& os, const tree_stats_t& stats) {
+        return stats.print(os);
+    }
+
+    // measures one phase when the policy is enabled, compiles to nothing otherwise
+    template <typename StatsT>
+    class phase_timer_t final {
+        using clock_t = std::chrono::steady_clock;
+
+        StatsT& stats_;
+        phase_t phase_;
+        clock_t::time_point start_;
+
+    public:
+        phase_timer_t(StatsT& stats, phase_t phase) noexcept : stats_(stats), phase_(phase) {
+            if constexpr (StatsT::enabled)
+                start_ = clock_t::now();
+        }
+
+        // ends the current phase and starts the next one
+        void next(phase_t phase) noexcept {
+            if constexpr (StatsT::enabled) {
+                clock_t::time_point now = clock_t::now();
+                stats_.add_time(phase_, std::chrono::duration_cast<std::chrono::nanoseconds>(now - start_).count());
+                start_ = now;
+            }
+            phase_ = phase;
+        }
+
+        ~phase_timer_t() {
+            if constexpr (StatsT::enabled)
+                stats_.add_time(phase_, std::chrono::duration_cast<std::chrono::nanoseconds>(clock_t::now() - start_).count());
+        }
+    };
+}
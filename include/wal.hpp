@@ -0,0 +1,338 @@
+#pragma once
+
+#include "avl_tree.hpp"
+#include "command_log.hpp"
+#include "fast_io.hpp"
+#include "tree_file.hpp"
+#include <charconv>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// write-ahead log of the commands that change the trees (k, s k, r), kept with
+// checkpoints in one directory: checkpoint.<n>.tree holds the trees after the
+// first n commands and log.<n>.wal the commands after them. Recovery maps the
+// latest checkpoint and replays its log only
+namespace wal {
+
+    constexpr std::string_view magic{"PTWAL001"};
+
+    // a log is magic followed by batches: a frame, then frame.size bytes of a
+    // command log (see command_log.hpp) whose FNV-1a hash is frame.checksum
+    struct frame_t final {
+        std::uint64_t size;
+        std::uint64_t checksum;
+    };
+
+    inline std::uint64_t checksum(std::string_view bytes) noexcept {
+        std::uint64_t hash = 14695981039346656037ull;
+        for (char c : bytes) {
+            hash ^= static_cast<std::uint8_t>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // commands that change the trees, anything else is not logged
+    template <std::integral KeyT>
+    bool is_logged(const command_log::command_t<KeyT>& command) noexcept {
+        using command_log::opcode_t;
+        return (command.opcode == opcode_t::insert || command.opcode == opcode_t::detach_insert ||
+                command.opcode == opcode_t::reset);
+    }
+
+    // TreeT is a perm_tree_t, the command is one is_logged() accepts
+    template <typename TreeT, std::integral KeyT>
+    void apply(TreeT& tree, const command_log::command_t<KeyT>& command) {
+        using command_log::opcode_t;
+        switch (command.opcode) {
+            case opcode_t::insert:
+                tree.insert(command.key);
+                break;
+
+            case opcode_t::detach_insert:
+                tree.detach_insert(command.key, avl_tree::discard_iterator{});
+                break;
+
+            case opcode_t::reset:
+                tree.reset();
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    // appends commands to a log; they are kept in memory until commit(), which
+    // writes them as one batch and syncs the file, so a group of commands shares
+    // one fsync. A command is durable once a commit() after it has returned
+    class log_t final {
+        // bytes go to a batch in memory instead of a FILE*
+        struct batch_output_t final {
+            std::string bytes;
+
+            batch_output_t& operator<<(char c) {
+                bytes.push_back(c);
+                return *this;
+            }
+
+            batch_output_t& operator<<(std::string_view str) {
+                bytes.append(str);
+                return *this;
+            }
+        };
+
+        std::string file_name_;
+        int fd_ = -1;
+        batch_output_t batch_;
+        // each batch is a whole command log, so it is decoded without the ones before
+        std::unique_ptr<command_log::log_writer_t<batch_output_t>> writer_;
+        std::size_t pending_ = 0;
+
+    private:
+        void write_all(const char* data, std::size_t size) {
+            while (size != 0) {
+                ssize_t written = ::write(fd_, data, size);
+                if (written < 0)
+                    throw std::runtime_error("can't write " + file_name_);
+                data += written;
+                size -= written;
+            }
+        }
+
+    public:
+        // opens a log for appending, creates it if there is none; size is the
+        // length of its valid part, anything after it (a torn batch) is cut off
+        explicit log_t(const std::string& file_name, std::size_t size = 0) : file_name_(file_name) {
+            fd_ = ::open(file_name.c_str(), O_WRONLY | O_CREAT, 0644);
+            if (fd_ < 0)
+                throw std::runtime_error("can't open " + file_name);
+
+            try {
+                if (size < magic.size()) {
+                    size = 0;
+                    batch_.bytes = magic;
+                }
+                if (::ftruncate(fd_, size) < 0 || ::lseek(fd_, size, SEEK_SET) < 0)
+                    throw std::runtime_error("can't write " + file_name);
+
+                write_all(batch_.bytes.data(), batch_.bytes.size());
+                batch_.bytes.clear();
+                if (::fsync(fd_) < 0)
+                    throw std::runtime_error("can't sync " + file_name);
+            } catch (...) {
+                ::close(fd_);
+                throw;
+            }
+        }
+
+        log_t(const log_t&) = delete;
+        log_t& operator=(const log_t&) = delete;
+
+        template <std::integral KeyT>
+        void append(const command_log::command_t<KeyT>& command) {
+            if (!writer_) {
+                batch_.bytes.assign(sizeof(frame_t), '\0'); // the frame is filled in by commit()
+                writer_ = std::make_unique<command_log::log_writer_t<batch_output_t>>(batch_);
+            }
+            writer_->write(command);
+            pending_++;
+        }
+
+        // commands appended since the last commit()
+        std::size_t pending() const noexcept { return pending_; }
+
+        void commit() {
+            if (pending_ == 0)
+                return;
+
+            std::string_view commands = std::string_view{batch_.bytes}.substr(sizeof(frame_t));
+            frame_t frame{commands.size(), checksum(commands)};
+            std::memcpy(batch_.bytes.data(), &frame, sizeof(frame));
+            write_all(batch_.bytes.data(), batch_.bytes.size());
+            if (::fdatasync(fd_) < 0)
+                throw std::runtime_error("can't sync " + file_name_);
+
+            batch_.bytes.clear();
+            writer_.reset();
+            pending_ = 0;
+        }
+
+        // commands not committed are lost, as they would be in a crash
+        ~log_t() { ::close(fd_); }
+    };
+
+    // calls func with every command of the committed batches of a log, stops at
+    // the end or at a batch a crash left torn; returns the length of the valid part
+    template <std::integral KeyT, typename FuncT>
+    std::size_t replay(const std::string& file_name, FuncT func) {
+        fast_io::mapped_file_t file{file_name};
+        std::string_view bytes{file.data(), file.size()};
+        if (!bytes.starts_with(magic))
+            return 0;
+
+        std::size_t valid = magic.size();
+        command_log::command_t<KeyT> command;
+        while (bytes.size() - valid >= sizeof(frame_t)) {
+            frame_t frame;
+            std::memcpy(&frame, bytes.data() + valid, sizeof(frame));
+            if (frame.size > bytes.size() - valid - sizeof(frame))
+                break;
+
+            std::string_view batch = bytes.substr(valid + sizeof(frame), frame.size);
+            if (checksum(batch) != frame.checksum)
+                break;
+
+            command_log::log_reader_t reader{batch.data(), batch.size()};
+            while (reader.read(command))
+                func(command);
+            valid += sizeof(frame) + frame.size;
+        }
+        return valid;
+    }
+
+    inline void sync_directory(const std::filesystem::path& dir) {
+        int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0)
+            throw std::runtime_error("can't open " + dir.string());
+        ::fsync(fd);
+        ::close(fd);
+    }
+
+    // trees of a perm_tree_t kept durable in a directory; group is the number of
+    // commands per commit, checkpoint_every the number of commands between
+    // checkpoints (0 for none but the first one)
+    template <typename TreeT>
+    class store_t final {
+        std::filesystem::path dir_;
+        std::size_t group_;
+        std::uint64_t checkpoint_every_;
+
+        std::uint64_t checkpoint_ = 0; // commands in the latest checkpoint
+        std::uint64_t commands_   = 0; // commands in it and its log
+        std::uint64_t replayed_   = 0;
+        std::unique_ptr<log_t> log_;
+
+    private:
+        std::string checkpoint_name(std::uint64_t commands) const {
+            return (dir_ / ("checkpoint." + std::to_string(commands) + ".tree")).string();
+        }
+
+        std::string log_name(std::uint64_t commands) const {
+            return (dir_ / ("log." + std::to_string(commands) + ".wal")).string();
+        }
+
+        // n of <prefix>.<n><suffix>, false for other names
+        static bool parse_name(const std::string& name, std::string_view prefix, std::string_view suffix,
+                               std::uint64_t& commands) {
+            std::string_view view{name};
+            if (!view.starts_with(prefix) || !view.ends_with(suffix) || view.size() <= prefix.size() + suffix.size())
+                return false;
+
+            const char* first = view.data() + prefix.size();
+            const char* last  = view.data() + view.size() - suffix.size();
+            auto [ptr, error] = std::from_chars(first, last, commands);
+            return (error == std::errc{} && ptr == last);
+        }
+
+        // removes the checkpoints and logs before the latest checkpoint
+        void remove_stale() {
+            for (const auto& entry : std::filesystem::directory_iterator{dir_}) {
+                std::string name = entry.path().filename().string();
+                std::uint64_t commands;
+                if ((parse_name(name, "checkpoint.", ".tree", commands) || parse_name(name, "log.", ".wal", commands)) &&
+                    commands != checkpoint_)
+                    std::filesystem::remove(entry.path());
+            }
+        }
+
+    public:
+        // recovers tree from the directory, which is created if needed; tree is
+        // kept as it is if there is no checkpoint yet, and becomes the first one
+        store_t(const std::string& dir, TreeT& tree, std::size_t group = 1000,
+                std::uint64_t checkpoint_every = 0) : dir_(dir), group_(std::max<std::size_t>(group, 1)),
+                                                      checkpoint_every_(checkpoint_every) {
+            std::filesystem::create_directories(dir_);
+
+            bool found = false;
+            for (const auto& entry : std::filesystem::directory_iterator{dir_}) {
+                std::uint64_t commands;
+                if (parse_name(entry.path().filename().string(), "checkpoint.", ".tree", commands) &&
+                    (!found || commands > checkpoint_)) {
+                    checkpoint_ = commands;
+                    found = true;
+                }
+            }
+
+            if (!found) {
+                tree_file::save(checkpoint_name(0), tree.frozen());
+                sync_directory(dir_);
+            } else {
+                tree = TreeT{tree_file::mapped_tree_t<TreeT>{checkpoint_name(checkpoint_), MADV_SEQUENTIAL}.tree()};
+            }
+
+            std::string name = log_name(checkpoint_);
+            std::size_t valid = 0;
+            if (std::filesystem::exists(name)) {
+                using key_type = typename TreeT::frozen_tree_t::key_type;
+                valid = replay<key_type>(name, [&](const command_log::command_t<key_type>& command) {
+                    apply(tree, command);
+                    replayed_++;
+                });
+            }
+            commands_ = checkpoint_ + replayed_;
+            log_ = std::make_unique<log_t>(name, valid);
+            remove_stale();
+        }
+
+        store_t(const store_t&) = delete;
+        store_t& operator=(const store_t&) = delete;
+
+        // logs a command before it is applied to the tree
+        template <std::integral KeyT>
+        void append(const command_log::command_t<KeyT>& command) {
+            log_->append(command);
+            commands_++;
+            if (log_->pending() >= group_)
+                log_->commit();
+        }
+
+        // true when checkpoint() should be called, once the commands are applied
+        bool checkpoint_due() const noexcept {
+            return (checkpoint_every_ != 0 && commands_ - checkpoint_ >= checkpoint_every_);
+        }
+
+        // makes every command appended so far durable
+        void commit() { log_->commit(); }
+
+        // saves tree, which has every command appended so far, and starts a new log;
+        // the old files are removed once the new checkpoint is in place
+        void checkpoint(const TreeT& tree) {
+            commit();
+            if (commands_ == checkpoint_)
+                return;
+
+            tree_file::save(checkpoint_name(commands_), tree.frozen());
+            log_ = std::make_unique<log_t>(log_name(commands_));
+            sync_directory(dir_);
+
+            checkpoint_ = commands_;
+            remove_stale();
+        }
+
+        // commands replayed from the log by the recovery
+        std::uint64_t replayed() const noexcept { return replayed_; }
+
+        // commands logged since the directory was created
+        std::uint64_t commands() const noexcept { return commands_; }
+    };
+}
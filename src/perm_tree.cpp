@@ -1,53 +1,219 @@
 #include "perm_tree.hpp"
+#include "command_log.hpp"
+#include "latency_histogram.hpp"
+#include "tree_file.hpp"
+#include "wal.hpp"
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
 
-int main()
-{
-    perm_tree::perm_tree_t<int> tree;
-
-    char command;
-    while(std::cin >> command) {
-        if (!std::cin.good())
-            return (std::cout << print_red("Error input, need command as char\n"), 1);
-
-        int  key;
-        char detach_command;
-        std::list<int> detached_keys;
-        switch (command) {
-            case 'k':
-                std::cin >> key;
-                if (!std::cin.good())
-                    return (std::cout << print_red("Error input, need key as int\n"), 1);
-
-                tree.insert(key);
+using tree_t       = perm_tree::perm_tree_t<int>;
+using stats_tree_t = perm_tree::perm_tree_t<int, std::less<int>, avl_tree::tree_stats_t>;
+using command_t    = command_log::command_t<int>;
+using command_log::opcode_t;
+
+namespace {
+    template <typename ViewT, typename IteratorT>
+    void print_key(fast_io::output_t& output, const ViewT& view, IteratorT it) {
+        if (it == view.end())
+            output << "none ";
+        else
+            output << *it << ' ';
+    }
+
+    // o i: i-th smallest key, n k: number of keys less than k,
+    // l k / u k: lower / upper bound of k, c a b: number of keys in [a, b]
+    template <typename ViewT>
+    void run_query(fast_io::output_t& output, const command_t& command, const ViewT& view) {
+        switch (command.opcode) {
+            case opcode_t::kth:
+                print_key(output, view, command.key < 0 ? view.end() : view.kth(command.key));
                 break;
 
-            case 's':
-                std::cin >> detach_command;
-                if (!std::cin.good() || detach_command != 'k')
-                    return (std::cout << print_red("Error input, need detach command == \'k\'\n"), 1);
-
-                std::cin >> key;
-                if (!std::cin.good())
-                    return (std::cout << print_red("Error input, need key as int\n"), 1);
-                
-                detached_keys = tree.detach_insert(key);
-                for (auto i : detached_keys)
-                    std::cout << i << " ";
+            case opcode_t::rank:
+                output << view.rank(command.key) << ' ';
                 break;
 
-            case 'r':
-                tree.reset();
+            case opcode_t::lower_bound:
+                print_key(output, view, view.lower_bound(command.key));
+                break;
+
+            case opcode_t::upper_bound:
+                print_key(output, view, view.upper_bound(command.key));
+                break;
+
+            case opcode_t::count_in_range:
+                output << view.count_in_range(command.key, command.last_key) << ' ';
                 break;
 
             default:
-                return (std::cout << print_red("Error input, need command: \"k\", \"s\" or \"r\"\n"), 1);
+                break;
+        }
+    }
+
+    // files of --load, --save and --wal, empty if not given
+    struct tree_files_t final {
+        std::string load;
+        std::string save;
+        std::string wal;
+        std::size_t group = 1000;
+        std::uint64_t checkpoint_every = 0;
+    };
+
+    // runs commands of a text_reader_t or a log_reader_t on a tree_t or a stats_tree_t,
+    // whose counters are printed to stderr; with Timed the time of each command
+    // (without reading it) goes to a histogram printed to stderr; the tree starts
+    // as the one of files.load and is saved to files.save after the commands;
+    // with files.wal it is recovered from that directory, and every command
+    // that changes it is logged there before it is run
+    template <typename TreeT, bool Timed, typename ReaderT>
+    int run(ReaderT& reader, fast_io::output_t& output, const tree_files_t& files) {
+        using clock_t = std::chrono::steady_clock;
+
+        TreeT tree = files.load.empty() ? TreeT{} : TreeT{tree_file::mapped_tree_t<TreeT>{files.load}.tree()};
+        std::unique_ptr<wal::store_t<TreeT>> store;
+        if (!files.wal.empty())
+            store = std::make_unique<wal::store_t<TreeT>>(files.wal, tree, files.group, files.checkpoint_every);
+
+        typename TreeT::insert_path_t detached_keys;
+        latency::histogram_t latencies;
+
+        command_t command;
+        try {
+            while (reader.read(command)) {
+                clock_t::time_point start;
+                if constexpr (Timed)
+                    start = clock_t::now();
+
+                if (store && wal::is_logged(command))
+                    store->append(command);
+
+                switch (command.opcode) {
+                    case opcode_t::insert:
+                        tree.insert(command.key);
+                        break;
+
+                    case opcode_t::detach_insert:
+                        detached_keys.clear();
+                        tree.detach_insert(command.key, std::back_inserter(detached_keys));
+                        for (auto i : detached_keys)
+                            output << i << ' ';
+                        break;
+
+                    case opcode_t::reset:
+                        tree.reset();
+                        break;
+
+                    default:
+                        run_query(output, command, command.detached ? tree.detached() : tree.view());
+                        break;
+                }
+
+                // old versions are never read here, so drop them once they dominate the buffer
+                if (tree.stored_nodes() > 4 * tree.size() + 4096)
+                    tree.release_versions();
+                if (store && store->checkpoint_due())
+                    store->checkpoint(tree);
+
+                if constexpr (Timed)
+                    latencies.add(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_t::now() - start).count());
+            }
+        } catch (const command_log::parse_error& e) {
+            if (store)
+                store->commit();
+            // everything printed before the error goes first
+            output.flush();
+            std::cout << print_red(e.what());
+            return 1;
         }
+        output << '\n';
+
+        if (store)
+            store->commit();
+        if (!files.save.empty())
+            tree_file::save(files.save, tree.frozen());
+
+        if constexpr (Timed)
+            latencies.print(std::cerr);
+        if constexpr (std::is_same_v<TreeT, stats_tree_t>)
+            tree.stats().print(std::cerr);
+        return 0;
+    }
 
-#ifdef DEBUG
-        std::cout << tree << "\n";
-#endif
+    bool parse_count(const char* str, std::uint64_t& count) {
+        const char* last = str + std::strlen(str);
+        auto [ptr, error] = std::from_chars(str, last, count);
+        return (error == std::errc{} && ptr == last);
     }
-    std::cout << "\n";
 
-    return 0;
-}
\ No newline at end of file
+    template <typename ReaderT>
+    int run(ReaderT& reader, fast_io::output_t& output, bool timed, bool stats, const tree_files_t& files) {
+        if (stats)
+            return timed ? run<stats_tree_t, true>(reader, output, files) : run<stats_tree_t, false>(reader, output, files);
+        return timed ? run<tree_t, true>(reader, output, files) : run<tree_t, false>(reader, output, files);
+    }
+}
+
+// reads text commands from the file given as an argument or from stdin,
+// or replays a binary log written by perm_tree_convert with --replay;
+// --latency prints percentiles of the command latencies to stderr,
+// --stats prints insertion counters of the tree to stderr;
+// --load starts from a tree saved by --save after the commands of an earlier run;
+// --wal keeps the trees in a directory and recovers them from it at start,
+// --group is the number of commands per fsync, --checkpoint the number of
+// commands between checkpoints; --load only seeds a directory without any
+int main(int argc, char* argv[])
+{
+    bool timed = false;
+    bool stats = false;
+    bool replay = false;
+    std::string file_name;
+    tree_files_t files;
+    std::uint64_t count = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--latency") == 0)
+            timed = true;
+        else if (std::strcmp(argv[i], "--stats") == 0)
+            stats = true;
+        else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc && file_name.empty())
+            replay = true, file_name = argv[++i];
+        else if (std::strcmp(argv[i], "--load") == 0 && i + 1 < argc)
+            files.load = argv[++i];
+        else if (std::strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+            files.save = argv[++i];
+        else if (std::strcmp(argv[i], "--wal") == 0 && i + 1 < argc)
+            files.wal = argv[++i];
+        else if (std::strcmp(argv[i], "--group") == 0 && i + 1 < argc && parse_count(argv[i + 1], count))
+            files.group = count, ++i;
+        else if (std::strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc && parse_count(argv[i + 1], count))
+            files.checkpoint_every = count, ++i;
+        else if (argv[i][0] != '-' && file_name.empty())
+            file_name = argv[i];
+        else
+            return (std::cout << print_red("Usage: " << argv[0] <<
+                                           " [--latency] [--stats] [--load <tree file>] [--save <tree file>]"
+                                           " [--wal <dir> [--group <commands>] [--checkpoint <commands>]]"
+                                           " [commands file | --replay <log file>]\n"), 1);
+    }
+
+    fast_io::output_t output;
+    try {
+        if (replay) {
+            fast_io::mapped_file_t log{file_name};
+            command_log::log_reader_t reader{log.data(), log.size()};
+            return run(reader, output, timed, stats, files);
+        }
+
+        std::unique_ptr<fast_io::input_t> input = !file_name.empty() ? std::make_unique<fast_io::input_t>(file_name)
+                                                                     : std::make_unique<fast_io::input_t>();
+        command_log::text_reader_t reader{*input};
+        return run(reader, output, timed, stats, files);
+    } catch (const command_log::parse_error& e) {
+        return (std::cout << print_red(e.what()), 1);
+    } catch (const std::runtime_error& e) {
+        return (std::cout << print_red("Error input, " << e.what() << "\n"), 1);
+    }
+}
@@ -0,0 +1,31 @@
+#include "command_log.hpp"
+#include "ANSI_colors.hpp"
+#include <iostream>
+#include <memory>
+
+// converts text commands from the file given as the only argument or from stdin
+// into a binary log on stdout, which perm_tree replays with --replay
+int main(int argc, char* argv[])
+{
+    if (argc > 2)
+        return (std::cerr << print_red("Usage: " << argv[0] << " [commands file] > <log file>\n"), 1);
+
+    try {
+        std::unique_ptr<fast_io::input_t> input = (argc == 2) ? std::make_unique<fast_io::input_t>(argv[1])
+                                                              : std::make_unique<fast_io::input_t>();
+        command_log::text_reader_t reader{*input};
+
+        fast_io::output_t output;
+        command_log::log_writer_t writer{output};
+
+        command_log::command_t<int> command;
+        while (reader.read(command))
+            writer.write(command);
+    } catch (const command_log::parse_error& e) {
+        return (std::cerr << print_red(e.what()), 1);
+    } catch (const std::runtime_error& e) {
+        return (std::cerr << print_red("Error input, " << e.what() << "\n"), 1);
+    }
+
+    return 0;
+}
@@ -1,34 +1,92 @@
-import random
 import os
+import sys
+import math
+import random
+import argparse
 
-count_tests = 5
+# without arguments regenerates tests_in/test_*.in as before,
+# with --output writes one stream of the requested shape to a file or to stdout ("-")
 
 to_curr_dir = os.path.dirname(os.path.realpath(__file__))
 
-for test_num in range(0, count_tests) :
-    file_name = to_curr_dir + "/tests_in/test_" + f'{test_num+1:03}' + ".in"
-    file = open(file_name, 'w')
+parser = argparse.ArgumentParser()
+parser.add_argument("--tests",        type=int,   default=5,    help="count of tests_in files")
+parser.add_argument("--output",       type=str,   default=None, help="write one stream here instead")
+parser.add_argument("--commands",     type=int,   default=1000, help="count of k and s k commands")
+parser.add_argument("--keys",         type=int,   default=[0, 10000], nargs=2, metavar=("MIN", "MAX"))
+parser.add_argument("--distribution", type=str,   default="uniform",
+                    choices=["uniform", "sequential", "zipf", "adversarial"])
+parser.add_argument("--detach-ratio", type=float, default=0.5,  help="share of s k among inserts")
+parser.add_argument("--detach-run",   type=int,   default=1,    help="s k in a row before a chance of r")
+parser.add_argument("--reset-chance", type=float, default=0.25, help="chance of r after a run of s k")
+parser.add_argument("--query-ratio",  type=float, default=0.0,  help="share of queries among commands")
+parser.add_argument("--seed",         type=int,   default=None)
+args = parser.parse_args()
+
+def keys_generator(rand):
+    first, last = args.keys
+    width = last - first + 1
+    i = 0
+    while True:
+        if args.distribution == "uniform":
+            yield rand.randint(first, last)
+        elif args.distribution == "sequential":
+            yield first + i % width
+        elif args.distribution == "zipf":
+            # rank with density ~ 1 / rank, scattered over the range
+            rank = int(math.exp(rand.random() * math.log(width + 1)))
+            yield first + (rank * 2654435761) % width
+        else:
+            # outermost keys first: first, last, first + 1, last - 1, ...
+            yield (first + (i // 2) % width) if i % 2 == 0 else (last - (i // 2) % width)
+        i += 1
 
-    count_commands = 1000
-    reset_chance = 0.25
-    keys = [0, 10000]
+def query(rand, key):
+    command = rand.choice("onluc")
+    if command == "o":
+        return "o " + str(rand.randint(0, args.keys[1] - args.keys[0]))
+    if command == "c":
+        return "c " + str(key) + " " + str(key + rand.randint(0, (args.keys[1] - args.keys[0]) // 10))
+    return command + " " + str(key)
 
-    for i in range(count_commands):
-        command = random.randint(0, 1)
-        test_str = ""
+def generate(out, rand):
+    keys = keys_generator(rand)
+    lines = []
+    generated = 0
+    while generated < args.commands:
+        if rand.random() < args.query_ratio:
+            prefix = "s " if rand.random() < args.detach_ratio else ""
+            lines.append(prefix + query(rand, next(keys)) + "\n")
 
-        if (command == 1):
-            test_str = "s "
+        if rand.random() >= args.detach_ratio:
+            lines.append("k " + str(next(keys)) + "\n")
+            generated += 1
+        else:
+            run = min(args.detach_run, args.commands - generated)
+            for _ in range(run):
+                lines.append("s k " + str(next(keys)) + "\n")
+            generated += run
 
-        if (command <= 1):
-            test_str += "k " + str(random.randint(keys[0], keys[1])) + "\n"
+            if rand.random() < args.reset_chance:
+                lines.append("r\n")
 
-        if (command == 1):
-            reset = random.randint(0, 100)
-            if (reset < reset_chance * 100):
-                test_str += "r\n"
+        if len(lines) >= 1 << 16:
+            out.write("".join(lines))
+            lines.clear()
+    out.write("".join(lines))
 
-        file.write(test_str)
-    
-    file.close()
-    print("test ", test_num + 1, " generated")
\ No newline at end of file
+rand = random.Random(args.seed)
+
+if args.output is not None:
+    if args.output == "-":
+        generate(sys.stdout, rand)
+    else:
+        with open(args.output, 'w') as file:
+            generate(file, rand)
+    sys.exit(0)
+
+for test_num in range(0, args.tests) :
+    file_name = to_curr_dir + "/tests_in/test_" + f'{test_num+1:03}' + ".in"
+    with open(file_name, 'w') as file:
+        generate(file, rand)
+    print("test ", test_num + 1, " generated")
@@ -0,0 +1,34 @@
+import sys
+import time
+import argparse
+import subprocess
+
+# times perm_tree on one commands file: commands/sec from a plain run,
+# latency percentiles from a second run with --latency
+
+parser = argparse.ArgumentParser()
+parser.add_argument("input", help="text commands file or, with --replay, a binary log")
+parser.add_argument("--exe",     type=str, default="./perm_tree")
+parser.add_argument("--replay",  action="store_true", help="input is a log of perm_tree_convert")
+parser.add_argument("--repeat",  type=int, default=3, help="plain runs, the fastest one is reported")
+args = parser.parse_args()
+
+command = [args.exe] + (["--replay"] if args.replay else []) + [args.input]
+
+def run(extra):
+    start = time.perf_counter()
+    result = subprocess.run(command[:1] + extra + command[1:], stdout=subprocess.DEVNULL,
+                            stderr=subprocess.PIPE, check=True)
+    return time.perf_counter() - start, result.stderr.decode("utf-8")
+
+_, stats = run(["--latency"])
+fields = dict(field.split("=") for field in stats.split())
+commands = int(fields["commands"])
+
+best = min(run([])[0] for _ in range(args.repeat))
+
+print(f"commands:     {commands}")
+print(f"wall time:    {best:.3f} s")
+print(f"commands/sec: {commands / best:.0f}")
+for name in ["p50", "p90", "p99", "p999", "max"]:
+    print(f"{name + ' latency:':13} {fields[name + '_ns']} ns")
@@ -1,5 +1,25 @@
 #include "perm_tree.hpp"
+#include "avl_multiset.hpp"
+#include "command_log.hpp"
+#include "concurrent_tree.hpp"
+#include "tree_file.hpp"
+#include "wal.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <gtest/gtest.h>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 void is_list_eq_vector(const std::list<int>& l, const std::vector<int>& v) {
     ASSERT_EQ(l.size(), v.size());
@@ -11,6 +31,38 @@ void is_list_eq_vector(const std::list<int>& l, const std::vector<int>& v) {
     }
 }
 
+template <typename NodeT>
+int check_subtree(const NodeT* node) {
+    if (!node)
+        return 0;
+
+    if (node->left_) {
+        EXPECT_LT(node->left_->key_, node->key_);
+    }
+    if (node->right_) {
+        EXPECT_LT(node->key_, node->right_->key_);
+    }
+
+    int left_height  = check_subtree(node->left_);
+    int right_height = check_subtree(node->right_);
+    EXPECT_LE(std::abs(left_height - right_height), 1) << " at key: " << node->key_ << "\n";
+    EXPECT_EQ(node->height_, std::max(left_height, right_height) + 1);
+    EXPECT_EQ(node->size_, (node->left_  ? node->left_->size_  : 0) +
+                           (node->right_ ? node->right_->size_ : 0) + 1);
+    return node->height_;
+}
+
+TEST(Avl_tree, test_invariants)
+{
+    avl_tree::avl_tree_t<int> tree;
+    std::mt19937 gen{1};
+    std::uniform_int_distribution<int> dist{0, 5000};
+    for (int i = 0; i < 3000; i++)
+        tree.insert(dist(gen));
+
+    check_subtree(tree.get_root());
+}
+
 TEST(Perm_tree_main, test_simple)
 {
     perm_tree::perm_tree_t<int> tree;
@@ -113,4 +165,1097 @@ TEST(Perm_tree_raii, test_move_assign_ctor)
     EXPECT_EQ(tree2.detach_insert(25).size(), 2);
 
     EXPECT_EQ(tree.detach_insert(5).size(), 0);
-}
\ No newline at end of file
+}
+
+TEST(Perm_tree_versions, test_versions_readable)
+{
+    perm_tree::perm_tree_t<int> tree;
+    for (int i = 0; i < 10; i++)
+        tree.insert(i * 10);
+
+    tree.detach_insert(5);
+    auto first = tree.last_version();
+    tree.detach_insert(15);
+    auto second = tree.last_version();
+    tree.reset();
+    tree.insert(25);
+
+    EXPECT_EQ(tree.versions_count(), 2);
+    check_subtree(tree.get_root());
+
+    EXPECT_TRUE (tree.version(first).contains(5));
+    EXPECT_FALSE(tree.version(first).contains(15));
+    EXPECT_EQ   (tree.version(first).size(), 11);
+
+    EXPECT_TRUE (tree.version(second).contains(5));
+    EXPECT_TRUE (tree.version(second).contains(15));
+    EXPECT_FALSE(tree.version(second).contains(25));
+    EXPECT_EQ   (tree.version(second).size(), 12);
+
+    EXPECT_TRUE (tree.view().contains(25));
+    EXPECT_FALSE(tree.view().contains(15));
+    EXPECT_EQ   (tree.size(), 12);
+
+    EXPECT_THROW(tree.version(2), std::out_of_range);
+}
+
+TEST(Perm_tree_versions, test_version_paths)
+{
+    perm_tree::perm_tree_t<int> tree;
+    tree.insert(4);
+    tree.insert(3);
+    tree.insert(8);
+    tree.insert(2);
+    tree.insert(7);
+    tree.insert(10);
+
+    tree.detach_insert(5);
+    auto version = tree.last_version();
+    tree.insert(6);
+
+    is_list_eq_vector(tree.version(version).insert_path(9), {4, 8, 10});
+    is_list_eq_vector(tree.detach_insert(9), {4, 8, 10});
+}
+
+TEST(Perm_tree_versions, test_release_versions)
+{
+    perm_tree::perm_tree_t<int> tree;
+    for (int i = 0; i < 100; i++) {
+        tree.insert(i);
+        tree.detach_insert(-i);
+    }
+
+    std::size_t stored = tree.stored_nodes();
+    tree.release_versions();
+
+    EXPECT_EQ(tree.versions_count(), 0);
+    EXPECT_LT(tree.stored_nodes(), stored);
+    EXPECT_EQ(tree.size(), 198);
+    EXPECT_EQ(tree.detached().size(), 199);
+    EXPECT_TRUE(tree.detached().contains(-99));
+
+    // the detached tree still shares all but its last path with the main one
+    EXPECT_LE(tree.stored_nodes(), tree.size() + tree.detached().size() / 2);
+    check_subtree(tree.get_root());
+
+    // and so does the frozen copy, which stores every node once
+    auto frozen = tree.frozen();
+    auto main   = tree.view().frozen();
+    EXPECT_EQ(frozen.bytes().size() * tree.size(), main.bytes().size() * tree.stored_nodes());
+}
+
+template <typename ViewT>
+void check_order_statistics(const ViewT& view, const std::set<int>& keys) {
+    ASSERT_EQ(view.size(), keys.size());
+
+    std::size_t i = 0;
+    for (int key : keys) {
+        EXPECT_EQ(*view.kth(i), key) << " at index: " << i << "\n";
+        EXPECT_EQ(view.rank(key), i);
+        ++i;
+    }
+    EXPECT_EQ(view.kth(keys.size()), view.end());
+
+    for (int key = -5; key < 105; key++) {
+        auto lower = keys.lower_bound(key);
+        auto upper = keys.upper_bound(key);
+        if (lower == keys.end())
+            EXPECT_EQ(view.lower_bound(key), view.end());
+        else
+            EXPECT_EQ(*view.lower_bound(key), *lower);
+
+        if (upper == keys.end())
+            EXPECT_EQ(view.upper_bound(key), view.end());
+        else
+            EXPECT_EQ(*view.upper_bound(key), *upper);
+
+        EXPECT_EQ(view.rank(key), std::distance(keys.begin(), lower));
+        EXPECT_EQ(view.count_in_range(key, key + 10),
+                  std::distance(lower, keys.upper_bound(key + 10)));
+    }
+    EXPECT_EQ(view.count_in_range(10, 0), 0);
+}
+
+TEST(Perm_tree_copy, test_copies_diverge)
+{
+    auto source = std::make_unique<perm_tree::perm_tree_t<int>>();
+    std::set<int> keys;
+    for (int i = 0; i < 2000; i++) {
+        source->insert(i * 2);
+        keys.insert(i * 2);
+    }
+    source->detach_insert(-1);
+    std::size_t stored = source->stored_nodes();
+
+    // copies share all nodes, and each one copies the paths it changes
+    perm_tree::perm_tree_t<int> copy{*source};
+    avl_tree::avl_tree_t<int> plain_copy{copy}; // the main tree only
+    EXPECT_EQ(copy.stored_nodes(), stored);
+
+    std::set<int> source_keys = keys, copy_keys = keys;
+    source_keys.insert(-1);
+    copy_keys.insert(-1);
+    for (int i = 0; i < 500; i++) {
+        source->insert(i * 4 + 1);
+        source_keys.insert(i * 4 + 1);
+        copy.erase(i * 8);
+        copy_keys.erase(i * 8);
+        plain_copy.insert(-i);
+    }
+    check_order_statistics(source->view(), source_keys);
+    check_order_statistics(copy.view(), copy_keys);
+    EXPECT_EQ(copy.version(0).size(), keys.size() + 1);
+
+    // nodes outlive the tree they were made by
+    source.reset();
+    check_subtree(copy.get_root());
+    check_order_statistics(copy.view(), copy_keys);
+    check_subtree(plain_copy.get_root());
+    EXPECT_EQ(plain_copy.size(), keys.size() + 499);
+
+    copy.release_versions();
+    check_order_statistics(copy.view(), copy_keys);
+}
+
+TEST(Perm_tree_order, test_order_statistics)
+{
+    perm_tree::perm_tree_t<int> tree;
+    std::set<int> keys;
+    std::mt19937 gen{3};
+    std::uniform_int_distribution<int> dist{0, 100};
+    for (int i = 0; i < 60; i++) {
+        int key = dist(gen);
+        tree.insert(key);
+        keys.insert(key);
+    }
+    check_order_statistics(tree, keys);
+
+    tree.detach_insert(-3);
+    tree.detach_insert(101);
+
+    keys.insert(-3);
+    check_order_statistics(tree.view(), keys);
+
+    keys.insert(101);
+    check_order_statistics(tree.detached(), keys);
+}
+
+TEST(Perm_tree_order, test_iterators)
+{
+    using tree_t = perm_tree::perm_tree_t<int>;
+    static_assert(std::bidirectional_iterator<tree_t::external_iterator>);
+
+    tree_t tree;
+    std::set<int> keys;
+    std::mt19937 gen{3};
+    std::uniform_int_distribution<int> dist{0, 10000};
+    for (int i = 0; i < 2000; i++) {
+        int key = dist(gen);
+        tree.insert(key);
+        keys.insert(key);
+    }
+    tree.detach_insert(-1);
+    tree.detach_insert(10001); // attaches -1 first
+
+    auto check_view = [](const auto& view, const std::set<int>& keys) {
+        EXPECT_TRUE(std::equal(view.begin(), view.end(), keys.begin(), keys.end()));
+        EXPECT_TRUE(std::equal(std::make_reverse_iterator(view.end()), std::make_reverse_iterator(view.begin()),
+                               keys.rbegin(), keys.rend()));
+        EXPECT_EQ(std::distance(view.begin(), view.end()), keys.size());
+
+        for (int key = -2; key < 10003; key += 37) {
+            auto lower = view.lower_bound(key);
+            auto expected = keys.lower_bound(key);
+            if (expected != keys.begin()) {
+                EXPECT_EQ(*std::prev(lower), *std::prev(expected));
+            }
+            if (expected != keys.end() && std::next(expected) != keys.end()) {
+                EXPECT_EQ(*std::next(lower), *std::next(expected));
+            }
+            EXPECT_EQ(view.find(key) == view.end(), !keys.contains(key));
+        }
+    };
+
+    std::set<int> main_keys = keys;
+    main_keys.insert(-1);
+    keys.insert({-1, 10001});
+    check_view(tree.view(), main_keys);
+    check_view(tree.detached(), keys);
+    EXPECT_EQ(*tree.find(-1), -1);
+
+    std::vector<int> scanned;
+    for (int key : tree.detached())
+        scanned.push_back(key);
+    EXPECT_TRUE(std::equal(scanned.begin(), scanned.end(), keys.begin(), keys.end()));
+
+    // ranges scanned without iterators, empty and reversed ones included
+    for (auto [first, last] : {std::pair{-5, 20000}, {100, 900}, {5000, 5000}, {900, 100}, {10002, 20000}}) {
+        scanned.clear();
+        tree.for_each_in_range(first, last, [&](int key) { scanned.push_back(key); });
+        std::vector<int> expected;
+        if (first <= last)
+            expected.assign(main_keys.lower_bound(first), main_keys.upper_bound(last));
+        EXPECT_EQ(scanned, expected) << " in [" << first << ", " << last << "]";
+    }
+
+    tree_t empty;
+    EXPECT_EQ(empty.begin(), empty.end());
+    empty.for_each_in_range(0, 1, [](int) { FAIL(); });
+}
+
+TEST(Avl_tree_build, test_build_from_sorted)
+{
+    std::vector<int> keys;
+    for (int i = 0; i < 1000; i++) {
+        keys.push_back(i * 2);
+        if (i % 7 == 0)
+            keys.push_back(i * 2);
+    }
+
+    avl_tree::avl_tree_t<int> tree;
+    tree.insert(-1);
+    tree.build_from_sorted(keys.begin(), keys.end());
+    check_subtree(tree.get_root());
+    check_order_statistics(tree, std::set<int>(keys.begin(), keys.end()));
+
+    tree.insert(7);
+    EXPECT_EQ(tree.size(), 1001);
+    check_subtree(tree.get_root());
+
+    std::reverse(keys.begin(), keys.end());
+    EXPECT_THROW(tree.build_from_sorted(keys.begin(), keys.end()), std::invalid_argument);
+    EXPECT_EQ(tree.size(), 1001);
+}
+
+TEST(Avl_tree_build, test_range_ctor)
+{
+    std::vector<int> keys(300000);
+    std::mt19937 gen{5};
+    std::uniform_int_distribution<int> dist{0, 100000};
+    for (auto& key : keys)
+        key = dist(gen);
+
+    perm_tree::perm_tree_t<int> tree{keys.begin(), keys.end()};
+    check_subtree(tree.get_root());
+    EXPECT_EQ(tree.size(), std::set<int>(keys.begin(), keys.end()).size());
+
+    tree.detach_insert(-1);
+    EXPECT_EQ(tree.detached().size(), tree.size() + 1);
+    EXPECT_EQ(*tree.detached().kth(0), -1);
+}
+
+TEST(Avl_tree_join, test_set_operations)
+{
+    std::mt19937 gen{8};
+    std::uniform_int_distribution<int> dist{0, 30000};
+    auto make_keys = [&](int count) {
+        std::set<int> keys;
+        for (int i = 0; i < count; i++)
+            keys.insert(dist(gen));
+        return keys;
+    };
+
+    for (std::size_t threads : {1, 4}) {
+        for (auto [lhs_count, rhs_count] : {std::pair{5000, 5000}, {10000, 300}, {200, 10000}, {0, 100}}) {
+            std::set<int> lhs_keys = make_keys(lhs_count);
+            std::set<int> rhs_keys = make_keys(rhs_count);
+            avl_tree::avl_tree_t<int> lhs{lhs_keys.begin(), lhs_keys.end()};
+            avl_tree::avl_tree_t<int> rhs{rhs_keys.begin(), rhs_keys.end()};
+
+            std::set<int> united = lhs_keys, subtracted, intersected;
+            united.insert(rhs_keys.begin(), rhs_keys.end());
+            std::set_difference(lhs_keys.begin(), lhs_keys.end(), rhs_keys.begin(), rhs_keys.end(),
+                                std::inserter(subtracted, subtracted.end()));
+            std::set_intersection(lhs_keys.begin(), lhs_keys.end(), rhs_keys.begin(), rhs_keys.end(),
+                                  std::inserter(intersected, intersected.end()));
+
+            avl_tree::avl_tree_t<int> tree{lhs};
+            tree.unite(rhs, threads);
+            check_subtree(tree.get_root());
+            check_order_statistics(tree, united);
+
+            tree = lhs;
+            tree.subtract(rhs, threads);
+            check_subtree(tree.get_root());
+            check_order_statistics(tree, subtracted);
+
+            tree = lhs;
+            tree.intersect(rhs, threads);
+            check_subtree(tree.get_root());
+            check_order_statistics(tree, intersected);
+        }
+    }
+}
+
+TEST(Avl_tree_join, test_join_split)
+{
+    avl_tree::avl_tree_t<int> tree;
+    for (int i = 0; i < 3000; i++)
+        tree.insert(i * 2);
+
+    auto greater = tree.split(2001);
+    check_subtree(tree.get_root());
+    check_subtree(greater.get_root());
+    EXPECT_EQ(tree.size(), 1001);
+    EXPECT_EQ(*greater.kth(0), 2002);
+
+    auto equal = greater.split(4000);
+    EXPECT_EQ(*equal.kth(0), 4000);
+    EXPECT_EQ(greater.size() + equal.size(), 1999);
+
+    // a short tree joined to a tall one and back
+    avl_tree::avl_tree_t<int> small;
+    small.insert(-1);
+    small.join(tree);
+    check_subtree(small.get_root());
+    EXPECT_EQ(small.size(), 1002);
+
+    small.join(greater);
+    small.join(equal);
+    check_subtree(small.get_root());
+    EXPECT_EQ(small.size(), 3001);
+    EXPECT_EQ(small.rank(4000), 2001);
+    EXPECT_THROW(small.join(tree), std::invalid_argument);
+}
+
+TEST(Perm_tree_join, test_split_join_rounds)
+{
+    perm_tree::perm_tree_t<int> tree;
+    for (int i = 0; i < 100000; i++)
+        tree.insert(i);
+
+    // the parts share the nodes, so neither is copied and none is left behind
+    for (int round = 0; round < 5; round++) {
+        auto greater = tree.split(50000);
+        tree.insert(-1 - round);
+        greater.erase(50000);
+        check_subtree(tree.get_root());
+        check_subtree(greater.get_root());
+        EXPECT_EQ(*greater.kth(0), 50001);
+
+        greater.insert(50000);
+        tree.join(greater);
+        greater.insert(200000);
+        EXPECT_EQ(tree.size(), 100001 + round);
+        EXPECT_EQ(*tree.kth(tree.size() - 1), 99999);
+        EXPECT_LT(tree.stored_nodes(), tree.size() + 1000);
+    }
+    check_subtree(tree.get_root());
+    EXPECT_EQ(tree.rank(50000), 50005);
+}
+
+TEST(Perm_tree_join, test_detach_unite)
+{
+    perm_tree::perm_tree_t<int> tree;
+    std::set<int> main_keys;
+    for (int i = 0; i < 1000; i++) {
+        tree.insert(i * 3);
+        main_keys.insert(i * 3);
+    }
+
+    std::set<int> delta_keys;
+    for (int i = 0; i < 500; i++)
+        delta_keys.insert(i * 5 + 1);
+    avl_tree::avl_tree_t<int> delta{delta_keys.begin(), delta_keys.end()};
+
+    std::set<int> united = main_keys;
+    united.insert(delta_keys.begin(), delta_keys.end());
+
+    // the main tree is untouched, the detached one and its version hold all keys
+    tree.detach_unite(delta, 4);
+    check_order_statistics(tree.view(), main_keys);
+    check_order_statistics(tree.detached(), united);
+    check_order_statistics(tree.version(tree.last_version()), united);
+
+    tree.attach();
+    check_subtree(tree.get_root());
+    tree.subtract(delta);
+    check_subtree(tree.get_root());
+    for (int key : delta_keys)
+        main_keys.erase(key);
+    check_order_statistics(tree, main_keys);
+}
+
+TEST(Avl_tree_erase, test_erase)
+{
+    perm_tree::perm_tree_t<int> tree;
+    std::set<int> keys;
+    std::mt19937 gen{9};
+    std::uniform_int_distribution<int> dist{0, 3000};
+    for (int i = 0; i < 1000; i++) {
+        int key = dist(gen);
+        tree.insert(key);
+        keys.insert(key);
+    }
+
+    // erased nodes are reused, so the buffer holds just the keys
+    for (int i = 0; i < 20000; i++) {
+        int key = dist(gen);
+        EXPECT_EQ(tree.erase(key), keys.erase(key) == 1);
+        key = dist(gen);
+        tree.insert(key);
+        keys.insert(key);
+        EXPECT_EQ(tree.stored_nodes(), keys.size());
+    }
+    check_subtree(tree.get_root());
+    check_order_statistics(tree, keys);
+
+    for (int key : std::set<int>{keys})
+        EXPECT_TRUE(tree.erase(key));
+    EXPECT_EQ(tree.size(), 0);
+    EXPECT_FALSE(tree.erase(0));
+}
+
+TEST(Perm_tree_erase, test_detach_erase)
+{
+    perm_tree::perm_tree_t<int> tree;
+    std::set<int> keys;
+    for (int i = 0; i < 500; i++) {
+        tree.insert(i * 2);
+        keys.insert(i * 2);
+    }
+
+    std::vector<std::set<int>> versions;
+    std::mt19937 gen{10};
+    std::uniform_int_distribution<int> dist{0, 999};
+    for (int i = 0; i < 300; i++) {
+        int key = dist(gen);
+        tree.attach();
+        auto expected = tree.view().insert_path(key);
+        auto path = tree.detach_erase(key);
+        EXPECT_EQ(path, expected);
+
+        keys.erase(key);
+        versions.push_back(keys);
+        check_order_statistics(tree.detached(), keys);
+    }
+
+    // every version keeps its keys
+    for (std::size_t i = 0; i < versions.size(); i++)
+        check_order_statistics(tree.version(i), versions[i]);
+    tree.attach();
+    check_subtree(tree.get_root());
+    check_order_statistics(tree, keys);
+
+    // erasing from the main tree copies nodes it shares with the versions
+    for (int key = 0; key < 1000; key += 3) {
+        EXPECT_EQ(tree.erase(key), keys.erase(key) == 1);
+        check_subtree(tree.get_root());
+    }
+    check_order_statistics(tree, keys);
+    check_order_statistics(tree.version(0), versions[0]);
+
+    // a detached tree with every key erased is still attached
+    perm_tree::perm_tree_t<int> single;
+    single.insert(1);
+    single.detach_erase(1);
+    EXPECT_EQ(single.size(), 1);
+    EXPECT_TRUE(single.detached().empty());
+    single.attach();
+    EXPECT_EQ(single.size(), 0);
+}
+
+TEST(Perm_tree_batch, test_batch_detach_insert)
+{
+    perm_tree::perm_tree_t<int> tree;
+    for (int i = 0; i < 100; i++)
+        tree.insert(i * 10);
+
+    perm_tree::perm_tree_t<int> single{tree};
+    std::vector<int> keys = {55, 5, 555, 56, 20, 995, 1};
+
+    std::size_t stored = tree.stored_nodes();
+    auto paths = tree.detach_insert(keys.begin(), keys.end());
+    ASSERT_EQ(paths.size(), keys.size());
+
+    std::size_t path_keys = 0;
+    for (std::size_t i = 0; i < keys.size(); i++) {
+        auto path = single.detach_insert(keys[i]);
+        is_list_eq_vector(path, std::vector<int>(paths[i].begin(), paths[i].end()));
+        path_keys += paths[i].size();
+    }
+    EXPECT_EQ(paths.keys().size(), path_keys);
+    EXPECT_LT(tree.stored_nodes() - stored, path_keys);
+
+    EXPECT_EQ(tree.size(), 100);
+    EXPECT_EQ(tree.detached().size(), 106);
+
+    tree.attach();
+    EXPECT_EQ(tree.size(), 106);
+    check_subtree(tree.get_root());
+}
+
+TEST(Perm_tree_paths, test_detach_insert_into_buffer)
+{
+    perm_tree::perm_tree_t<int> tree;
+    for (int i = 0; i < 1000; i++)
+        tree.insert(i * 3);
+    perm_tree::perm_tree_t<int> list_tree{tree};
+
+    std::vector<int> buffer;
+    buffer.reserve(64);
+    const int* data = buffer.data();
+
+    perm_tree::perm_tree_t<int>::insert_path_t inline_path;
+    for (int key = -10; key < 3010; key += 7) {
+        buffer.clear();
+        tree.detach_insert(key, std::back_inserter(buffer));
+        EXPECT_EQ(buffer.data(), data);
+
+        auto path = list_tree.detach_insert(key);
+        is_list_eq_vector(path, buffer);
+
+        inline_path.clear();
+        tree.view().insert_path(key + 1, std::back_inserter(inline_path));
+        is_list_eq_vector(tree.view().insert_path(key + 1),
+                          std::vector<int>(inline_path.begin(), inline_path.end()));
+    }
+}
+
+// string key that counts its copies
+struct counted_key final {
+    static inline int copies = 0;
+    std::string value;
+
+    counted_key(std::string_view view) : value(view) {}
+    counted_key(std::size_t count, char c) : value(count, c) {}
+    counted_key(const counted_key& other) : value(other.value) { copies++; }
+    counted_key(counted_key&& other) noexcept = default;
+    counted_key& operator=(const counted_key& other) { value = other.value; copies++; return *this; }
+    counted_key& operator=(counted_key&& other) noexcept = default;
+};
+
+struct counted_less final {
+    using is_transparent = void;
+
+    static std::string_view view(const counted_key& key) noexcept { return key.value; }
+    static std::string_view view(std::string_view key) noexcept { return key; }
+
+    template <typename L, typename R>
+    bool operator()(const L& lhs, const R& rhs) const noexcept { return view(lhs) < view(rhs); }
+};
+
+TEST(Avl_tree_keys, test_move_and_transparent_lookup)
+{
+    perm_tree::perm_tree_t<counted_key, counted_less> tree;
+    counted_key::copies = 0;
+    for (int i = 0; i < 100; i++) {
+        counted_key key{"key number " + std::to_string(i * 7 % 100)};
+        tree.insert(std::move(key));
+    }
+    tree.emplace(20, 'z');
+    tree.emplace(std::string_view{"key number 7"});
+    EXPECT_EQ(counted_key::copies, 0);
+    EXPECT_EQ(tree.size(), 101);
+
+    // lookups by string_view build no key
+    std::string_view present = "key number 42";
+    EXPECT_TRUE(tree.view().contains(present));
+    EXPECT_FALSE(tree.view().contains(std::string_view{"key number 420"}));
+    EXPECT_EQ(tree.rank(std::string_view{"key number 10"}), 2);
+    EXPECT_EQ(tree.lower_bound(std::string_view{"key number 5"})->value, "key number 5");
+    EXPECT_EQ(tree.upper_bound(std::string_view{"key number 99"})->value, std::string(20, 'z'));
+    EXPECT_EQ(tree.count_in_range(std::string_view{"key number 1"}, std::string_view{"key number 2"}), 12);
+    EXPECT_EQ(counted_key::copies, 0);
+
+    // a frozen tree holds copies of the keys, lookups in it copy nothing more
+    auto frozen = tree.frozen();
+    counted_key::copies = 0;
+    EXPECT_TRUE(frozen.contains(present));
+    EXPECT_FALSE(frozen.contains(std::string_view{"key"}));
+    EXPECT_EQ(counted_key::copies, 0);
+    EXPECT_EQ(frozen.insert_path(present).size(), tree.view().insert_path(present).size());
+
+    // keys without a transparent comparator still convert
+    avl_tree::avl_tree_t<std::string> strings;
+    strings.insert("b");
+    strings.emplace(3, 'a');
+    EXPECT_TRUE(strings.view().contains("aaa"));
+    EXPECT_EQ(strings.rank("b"), 1);
+    EXPECT_EQ(*strings.lower_bound("ab"), "b");
+}
+
+// a composite key, ordered by a comparator and never hashed
+struct point final {
+    int x, y;
+};
+
+struct point_less final {
+    bool operator()(const point& lhs, const point& rhs) const noexcept {
+        return std::tie(lhs.x, lhs.y) < std::tie(rhs.x, rhs.y);
+    }
+};
+
+TEST(Avl_multiset, test_counts)
+{
+    avl_multiset::avl_multiset_t<int> set;
+    std::multiset<int> keys;
+    std::mt19937 gen{5};
+    std::uniform_int_distribution<int> dist{0, 50};
+    for (int i = 0; i < 3000; i++) {
+        int key = dist(gen);
+        if (i % 3 == 2) {
+            EXPECT_EQ(set.erase(key), keys.count(key) != 0);
+            if (auto it = keys.find(key); it != keys.end())
+                keys.erase(it);
+        } else {
+            set.insert(key);
+            keys.insert(key);
+        }
+    }
+
+    ASSERT_EQ(set.size(), keys.size());
+    std::size_t i = 0;
+    for (int key : keys)
+        EXPECT_EQ(set.kth(i++)->key, key);
+    EXPECT_EQ(set.kth(keys.size()), set.end());
+
+    for (int key = -1; key < 52; key++) {
+        EXPECT_EQ(set.count(key), keys.count(key));
+        EXPECT_EQ(set.contains(key), keys.contains(key));
+        EXPECT_EQ(set.find(key) == set.end(), !keys.contains(key));
+        EXPECT_EQ(set.rank(key), std::distance(keys.begin(), keys.lower_bound(key)));
+        EXPECT_EQ(set.count_in_range(key, key + 5),
+                  std::distance(keys.lower_bound(key), keys.upper_bound(key + 5)));
+    }
+
+    avl_multiset::avl_multiset_t<point, point_less> points;
+    for (int j = 0; j < 10; j++)
+        points.insert({j % 3, j % 2});
+    EXPECT_EQ(points.size(), 10);
+    EXPECT_EQ(points.count({0, 0}), 2);
+    EXPECT_EQ(points.count({2, 1}), 1);
+    EXPECT_EQ(points.rank({1, 0}), 4);
+    EXPECT_EQ(points.kth(4)->key.x, 1);
+    EXPECT_EQ(points.find({2, 0})->count, 2);
+    EXPECT_EQ(points.find({3, 0}), points.end());
+}
+
+TEST(Frozen_tree, test_same_paths)
+{
+    perm_tree::perm_tree_t<int> tree;
+    std::mt19937 gen{5};
+    std::uniform_int_distribution<int> dist{0, 20000};
+    for (int i = 0; i < 5000; i++)
+        tree.insert(dist(gen));
+
+    auto frozen = tree.frozen();
+    EXPECT_EQ(frozen.size(), tree.size());
+    EXPECT_TRUE(perm_tree::perm_tree_t<int>().frozen().empty());
+
+    std::vector<int> path;
+    for (int key = -5; key < 20005; key += 3) {
+        EXPECT_EQ(frozen.contains(key), tree.view().contains(key));
+
+        path.clear();
+        frozen.insert_path(key, std::back_inserter(path));
+        is_list_eq_vector(tree.view().insert_path(key), path);
+    }
+
+    // a path query on a frozen tree is what detach_insert returns
+    path.clear();
+    frozen.insert_path(20001, std::back_inserter(path));
+    is_list_eq_vector(tree.detach_insert(20001), path);
+}
+
+TEST(Frozen_tree, test_batch_paths)
+{
+    perm_tree::perm_tree_t<int> tree;
+    std::mt19937 gen{6};
+    std::uniform_int_distribution<int> dist{-50000, 50000};
+    for (int i = 0; i < 20000; i++)
+        tree.insert(dist(gen));
+
+    std::vector<int> keys;
+    for (int i = 0; i < 1001; i++)
+        keys.push_back(dist(gen));
+    for (std::size_t k = 0; k < tree.size(); k += 997)
+        keys.push_back(*tree.kth(k));
+
+    auto frozen = tree.frozen();
+    for (auto isa : {batch_search::isa_t::scalar, batch_search::isa_t::avx2}) {
+        auto paths = frozen.insert_paths(keys.begin(), keys.end(), isa);
+        ASSERT_EQ(paths.size(), keys.size());
+
+        // differential test against a detached insertion into the same tree
+        for (std::size_t i = 0; i < keys.size(); i++) {
+            auto path = tree.detach_insert(keys[i]);
+            tree.reset();
+            is_list_eq_vector(path, std::vector<int>(paths[i].begin(), paths[i].end()));
+        }
+    }
+
+    EXPECT_EQ(frozen.insert_paths(keys.begin(), keys.begin()).size(), 0);
+    auto empty_paths = perm_tree::perm_tree_t<int>().frozen().insert_paths(keys.begin(), keys.end());
+    EXPECT_EQ(empty_paths.size(), keys.size());
+    EXPECT_TRUE(empty_paths.keys().empty());
+}
+
+TEST(Tree_file, test_save_and_map)
+{
+    std::set<int> keys;
+    perm_tree::perm_tree_t<int> tree;
+    std::mt19937 gen{9};
+    std::uniform_int_distribution<int> dist{0, 100};
+    for (int i = 0; i < 60; i++) {
+        int key = dist(gen);
+        keys.insert(key);
+        tree.insert(key);
+    }
+    // the second detach_insert attaches the first one
+    tree.detach_insert(101);
+    tree.detach_insert(-3);
+    keys.insert(101);
+    std::set<int> detached_keys = keys;
+    detached_keys.insert(-3);
+
+    auto file_name = (std::filesystem::temp_directory_path() / "perm_tree_file.tree").string();
+    tree_file::save(file_name, tree.frozen());
+    {
+        tree_file::mapped_tree_t<perm_tree::perm_tree_t<int>> mapped{file_name};
+        const auto& frozen = mapped.tree();
+        EXPECT_EQ(frozen.size(), keys.size());
+        EXPECT_EQ(frozen.detached().size(), detached_keys.size());
+        // nodes on the path to -3 are the only ones stored twice
+        EXPECT_LE(frozen.bytes().size(), (keys.size() + frozen.height() + 1) * frozen.node_size);
+
+        std::vector<int> path;
+        for (int key = -5; key < 105; key++) {
+            path.clear();
+            frozen.insert_path(key, std::back_inserter(path));
+            is_list_eq_vector(tree.view().insert_path(key), path);
+
+            path.clear();
+            frozen.detached().insert_path(key, std::back_inserter(path));
+            is_list_eq_vector(tree.detached().insert_path(key), path);
+        }
+
+        // the restored trees share nodes as the saved ones did
+        perm_tree::perm_tree_t<int> restored{frozen};
+        EXPECT_EQ(restored.stored_nodes(), frozen.bytes().size() / frozen.node_size);
+        check_subtree(restored.get_root());
+        check_order_statistics(restored.view(), keys);
+        check_order_statistics(restored.detached(), detached_keys);
+
+        avl_tree::avl_tree_t<int> main{frozen};
+        check_order_statistics(main.view(), keys);
+
+        restored.insert(-4);
+        detached_keys.insert(-4);
+        check_subtree(restored.get_root());
+        check_order_statistics(restored.view(), detached_keys);
+        check_order_statistics(perm_tree::perm_tree_t<int>{frozen}.view(), keys);
+    }
+
+    tree_file::save(file_name, perm_tree::perm_tree_t<int>().frozen());
+    EXPECT_TRUE(perm_tree::perm_tree_t<int>{tree_file::mapped_tree_t<perm_tree::perm_tree_t<int>>{file_name}.tree()}.view().empty());
+
+    EXPECT_THROW(tree_file::mapped_tree_t<perm_tree::perm_tree_t<long long>>{file_name}, std::runtime_error);
+    std::ofstream{file_name} << "not a tree";
+    EXPECT_THROW(tree_file::mapped_tree_t<perm_tree::perm_tree_t<int>>{file_name}, std::runtime_error);
+
+    // sizes of the header are checked against the nodes before anything reads them
+    for (std::size_t offset : {offsetof(tree_file::header_t, size), offsetof(tree_file::header_t, detached_size)}) {
+        tree_file::save(file_name, tree.frozen());
+        {
+            std::fstream file{file_name, std::ios::in | std::ios::out | std::ios::binary};
+            std::uint64_t size = 1000000;
+            file.seekp(offset);
+            file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+        }
+        EXPECT_THROW(tree_file::mapped_tree_t<perm_tree::perm_tree_t<int>>{file_name}, std::runtime_error);
+    }
+
+    // so are the children: out of the nodes, back to the root, or shared by two parents
+    using frozen_tree_t = perm_tree::perm_tree_t<int>::frozen_tree_t;
+    std::size_t root_children = tree_file::header_size + frozen_tree_t::node_size - 2 * sizeof(std::uint32_t);
+    for (int corruption = 0; corruption < 3; corruption++) {
+        tree_file::save(file_name, tree.frozen());
+        {
+            std::fstream file{file_name, std::ios::in | std::ios::out | std::ios::binary};
+            std::uint32_t children[2];
+            file.seekg(root_children);
+            file.read(reinterpret_cast<char*>(children), sizeof(children));
+
+            std::uint32_t child = (corruption == 0) ? 1000000 : (corruption == 1) ? 0 : children[1];
+            file.seekp(root_children);
+            file.write(reinterpret_cast<const char*>(&child), sizeof(child));
+        }
+        EXPECT_THROW(tree_file::mapped_tree_t<perm_tree::perm_tree_t<int>>{file_name}, std::runtime_error);
+    }
+    std::filesystem::remove(file_name);
+}
+
+TEST(Wal, test_recover)
+{
+    using tree_t = perm_tree::perm_tree_t<int>;
+    auto dir = std::filesystem::temp_directory_path() / "perm_tree_wal";
+    std::filesystem::remove_all(dir);
+
+    std::mt19937 gen{10};
+    std::uniform_int_distribution<int> dist{0, 100};
+    auto random_command = [&] {
+        command_log::command_t<int> command;
+        int kind = dist(gen);
+        command.opcode = (kind < 60) ? command_log::opcode_t::insert :
+                         (kind < 95) ? command_log::opcode_t::detach_insert : command_log::opcode_t::reset;
+        command.key = dist(gen);
+        return command;
+    };
+
+    tree_t expected;
+    auto run = [&](wal::store_t<tree_t>& store, tree_t& tree, int count) {
+        for (int i = 0; i < count; i++) {
+            auto command = random_command();
+            store.append(command);
+            wal::apply(tree, command);
+            wal::apply(expected, command);
+            if (store.checkpoint_due())
+                store.checkpoint(tree);
+        }
+    };
+    auto keys_of = [](const tree_t::tree_view& view) {
+        std::set<int> keys;
+        for (std::size_t i = 0; i < view.size(); i++)
+            keys.insert(*view.kth(i));
+        return keys;
+    };
+    auto check = [&](const tree_t& tree) {
+        check_order_statistics(tree.view(), keys_of(expected.view()));
+        check_order_statistics(tree.detached(), keys_of(expected.detached()));
+    };
+
+    {
+        tree_t tree;
+        wal::store_t<tree_t> store{dir.string(), tree, 8, 50};
+        run(store, tree, 333);
+        store.commit();
+    }
+    {
+        // the checkpoint after 300 commands and the 33 commands logged after it
+        tree_t tree;
+        wal::store_t<tree_t> store{dir.string(), tree, 8};
+        EXPECT_EQ(store.commands(), 333);
+        EXPECT_EQ(store.replayed(), 33);
+        check(tree);
+
+        // not committed, lost as in a crash
+        tree_t committed{expected};
+        run(store, tree, 5);
+        expected = committed;
+    }
+
+    // a torn batch at the end is dropped and overwritten by the next one
+    std::ofstream{(dir / "log.300.wal").string(), std::ios::app} << "torn batch";
+    {
+        tree_t tree;
+        wal::store_t<tree_t> store{dir.string(), tree, 1};
+        EXPECT_EQ(store.commands(), 333);
+        check(tree);
+        run(store, tree, 3);
+    }
+    {
+        tree_t tree;
+        wal::store_t<tree_t> store{dir.string(), tree};
+        EXPECT_EQ(store.commands(), 336);
+        check(tree);
+        store.checkpoint(tree);
+    }
+    EXPECT_EQ(std::distance(std::filesystem::directory_iterator{dir}, std::filesystem::directory_iterator{}), 2);
+    std::filesystem::remove_all(dir);
+}
+
+TEST(Fast_io, test_input_like_istream)
+{
+    auto file_name = std::filesystem::temp_directory_path() / "perm_tree_fast_io.in";
+    {
+        std::ofstream file{file_name};
+        file << "k +5\n s k\t-3  o 12345678901 k";
+    }
+
+    fast_io::input_t input{file_name.string()};
+    char c;
+    int  key;
+    ASSERT_TRUE(input.read(c));   EXPECT_EQ(c, 'k');
+    ASSERT_TRUE(input.read(key)); EXPECT_EQ(key, 5);
+    ASSERT_TRUE(input.read(c));   EXPECT_EQ(c, 's');
+    ASSERT_TRUE(input.read(c));   EXPECT_EQ(c, 'k');
+    ASSERT_TRUE(input.read(key)); EXPECT_EQ(key, -3);
+    ASSERT_TRUE(input.read(c));   EXPECT_EQ(c, 'o');
+    EXPECT_FALSE(input.read(key));
+
+    long long big_key;
+    ASSERT_TRUE(input.read(big_key)); EXPECT_EQ(big_key, 12345678901);
+    ASSERT_TRUE(input.read(c));       EXPECT_EQ(c, 'k');
+    EXPECT_FALSE(input.read(key));
+    EXPECT_FALSE(input.read(c));
+
+    std::filesystem::remove(file_name);
+}
+
+TEST(Command_log, test_text_to_log_round_trip)
+{
+    auto dir       = std::filesystem::temp_directory_path();
+    auto text_name = dir / "perm_tree_command_log.in";
+    auto log_name  = dir / "perm_tree_command_log.log";
+    {
+        std::ofstream file{text_name};
+        file << "k 10 k -2147483648 k 2147483647 s k 5 r s o 1 o -3 n 7 l 8 u 9 s c -4 40";
+    }
+
+    using command_t = command_log::command_t<int>;
+    std::vector<command_t> commands;
+    {
+        fast_io::input_t input{text_name.string()};
+        command_log::text_reader_t reader{input};
+
+        std::FILE* file = std::fopen(log_name.c_str(), "wb");
+        ASSERT_NE(file, nullptr);
+        {
+            fast_io::output_t output{file};
+            command_log::log_writer_t writer{output};
+
+            command_t command;
+            while (reader.read(command)) {
+                commands.push_back(command);
+                writer.write(command);
+            }
+        }
+        std::fclose(file);
+    }
+    ASSERT_EQ(commands.size(), 11);
+    EXPECT_EQ(commands[3].opcode, command_log::opcode_t::detach_insert);
+    EXPECT_TRUE(commands[5].detached);
+    EXPECT_EQ(commands[10].last_key, 40);
+
+    fast_io::mapped_file_t log{log_name.string()};
+    command_log::log_reader_t reader{log.data(), log.size()};
+    command_t command;
+    for (auto& expected : commands) {
+        ASSERT_TRUE(reader.read(command));
+        EXPECT_EQ(command.opcode,   expected.opcode);
+        EXPECT_EQ(command.detached, expected.detached);
+        EXPECT_EQ(command.key,      expected.key);
+        if (command.opcode == command_log::opcode_t::count_in_range) {
+            EXPECT_EQ(command.last_key, expected.last_key);
+        }
+    }
+    EXPECT_FALSE(reader.read(command));
+
+    EXPECT_THROW((command_log::log_reader_t{log.data(), 3}), command_log::parse_error);
+    command_log::log_reader_t truncated{log.data(), command_log::magic.size() + 1};
+    EXPECT_THROW(truncated.read(command), command_log::parse_error);
+
+    std::filesystem::remove(text_name);
+    std::filesystem::remove(log_name);
+}
+
+TEST(Tree_stats, test_insert_counters)
+{
+    using stats_tree_t = perm_tree::perm_tree_t<int, std::less<int>, avl_tree::tree_stats_t>;
+    static_assert(sizeof(perm_tree::perm_tree_t<int>) < sizeof(stats_tree_t));
+
+    stats_tree_t tree;
+    for (int i = 0; i < 1024; i++)
+        tree.insert(i);
+    tree.insert(5);
+
+    const avl_tree::tree_stats_t& stats = tree.stats();
+    EXPECT_EQ(stats[avl_tree::event_t::insert],     1025);
+    EXPECT_EQ(stats[avl_tree::event_t::node_alloc], 1024);
+    EXPECT_EQ(stats[avl_tree::event_t::node_copy],  0);
+    EXPECT_EQ(stats[avl_tree::event_t::rotate_right], 0);
+    // ascending keys: every insertion but the ones completing a perfect tree rotates
+    EXPECT_EQ(stats[avl_tree::event_t::rotate_left], 1024 - 11);
+    EXPECT_GT(stats[avl_tree::event_t::compare], stats[avl_tree::event_t::ancestor_update]);
+
+    auto path = tree.detach_insert(2000);
+    EXPECT_EQ(stats[avl_tree::event_t::detach_insert], 1);
+    EXPECT_EQ(stats[avl_tree::event_t::node_copy], path.size());
+
+    tree.stats().clear();
+    EXPECT_EQ(tree.stats()[avl_tree::event_t::insert], 0);
+}
+
+// copying a const tree only bumps its atomic generation, so copies and reads
+// of one tree may run at once
+TEST(Concurrent_copy, test_copies_of_const_tree)
+{
+    perm_tree::perm_tree_t<int> source;
+    for (int i = 0; i < 1000; i++)
+        source.insert(i * 2);
+    const perm_tree::perm_tree_t<int>& tree = source;
+
+    std::atomic<int> waiting{4};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&tree, &waiting, t] {
+            // all threads start copying at once
+            waiting.fetch_sub(1);
+            while (waiting.load() != 0)
+                std::this_thread::yield();
+
+            for (int i = 0; i < 50; i++) {
+                perm_tree::perm_tree_t<int> copy{tree};
+                copy.insert(t * 1000 + i * 2 + 1);
+                copy.erase(i * 2);
+                EXPECT_EQ(copy.size(), 1000);
+                EXPECT_TRUE(tree.view().contains(i * 2));
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    EXPECT_EQ(tree.size(), 1000);
+    check_subtree(tree.get_root());
+}
+
+TEST(Concurrent_tree, test_readers_see_prefixes)
+{
+    using tree_t = concurrent_tree::concurrent_tree_t<int>;
+    constexpr int count = 50000;
+
+    std::vector<int> keys(count);
+    for (int i = 0; i < count; i++)
+        keys[i] = i;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937{7});
+
+    tree_t tree;
+    std::atomic<bool> done = false;
+
+    // a snapshot of size s holds exactly the first s inserted keys
+    auto read = [&] {
+        tree_t::reader_t reader{tree};
+        std::size_t last_size = 0;
+        while (!done.load()) {
+            tree_t::snapshot_t snapshot{reader};
+            auto view = snapshot.view();
+            std::size_t size = view.size();
+            ASSERT_GE(size, last_size);
+            last_size = size;
+            if (size == 0)
+                continue;
+
+            EXPECT_TRUE(view.contains(keys[size - 1]));
+            EXPECT_TRUE(view.contains(keys[(size - 1) / 2]));
+            if (size < count) {
+                EXPECT_FALSE(view.contains(keys[size]));
+            }
+            EXPECT_EQ(view.count_in_range(0, count), size);
+        }
+    };
+
+    std::vector<std::jthread> readers;
+    for (int i = 0; i < 3; i++)
+        readers.emplace_back(read);
+
+    for (int key : keys)
+        tree.insert(key);
+    done.store(true);
+    readers.clear();
+
+    EXPECT_EQ(tree.size(), count);
+    EXPECT_EQ(tree.reclaim(), 0);
+    EXPECT_LE(tree.stored_nodes(), 4 * tree.size() + 4096);
+}